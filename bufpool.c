@@ -0,0 +1,196 @@
+/*
+ * bufpool.c - Source for the pooled, refcounted I/O buffers.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ *
+ * Buffers are carved out of 2 MiB slabs that are mapped as they are needed,
+ * with huge pages when asked for and available. A connection only borrows
+ * buffers while a request is being read, so memory follows the requests in
+ * flight and not the number of open connections.
+ *
+ ****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "bufpool.h"
+
+/* Buffers in each slab */
+#define BUFPOOL_PER_SLAB (BUFPOOL_SLAB / BUFPOOL_BUFSIZE)
+
+/* Slab of buffers. */
+typedef struct bufslab {
+	void *mem;
+	bool huge;
+	iobuf_t bufs[BUFPOOL_PER_SLAB];
+	struct bufslab *next;
+} bufslab_t;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static bufslab_t *slabs;
+static iobuf_t *free_list;
+static size_t max_slabs;
+static bool use_huge;
+static bufpool_stats_t stats;
+
+/* ---------------------------- Private Functions ------------------------ */
+
+/* Map another slab and put its buffers on the free list, pool_lock must
+ * be held.
+ */
+static int bufpool_grow(void)
+{
+	bufslab_t *slab;
+	void *mem = MAP_FAILED;
+	size_t i;
+
+	if(stats.slabs >= max_slabs)
+		return -1;
+
+	slab = calloc(1, sizeof(bufslab_t));
+	if(slab == NULL)
+		return -1;
+
+	/* Fall back to normal pages when none are reserved */
+	if(use_huge) {
+		mem = mmap(NULL, BUFPOOL_SLAB, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		slab->huge = mem != MAP_FAILED;
+	}
+	if(mem == MAP_FAILED) {
+		mem = mmap(NULL, BUFPOOL_SLAB, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(mem == MAP_FAILED) {
+			free(slab);
+			return -1;
+		}
+#ifdef MADV_HUGEPAGE
+		if(use_huge)
+			madvise(mem, BUFPOOL_SLAB, MADV_HUGEPAGE);
+#endif
+	}
+
+	slab->mem = mem;
+	for(i = 0; i < BUFPOOL_PER_SLAB; i++) {
+		slab->bufs[i].data = (char *)mem + i * BUFPOOL_BUFSIZE;
+		slab->bufs[i].next = free_list;
+		free_list = &slab->bufs[i];
+	}
+	slab->next = slabs;
+	slabs = slab;
+	stats.slabs++;
+	stats.huge += slab->huge;
+	stats.total += BUFPOOL_PER_SLAB;
+	stats.free += BUFPOOL_PER_SLAB;
+	return 0;
+}
+
+/* ----------------------------- Public Functions ------------------------ */
+
+/* Set up the pool.
+ */
+int bufpool_init(size_t budget, bool huge)
+{
+	max_slabs = budget / BUFPOOL_SLAB;
+	if(max_slabs == 0)
+		max_slabs = 1;
+	use_huge = huge;
+
+	/* Map the first slab now so a bad setting shows up at startup */
+	pthread_mutex_lock(&pool_lock);
+	if(bufpool_grow()) {
+		pthread_mutex_unlock(&pool_lock);
+		return -1;
+	}
+	pthread_mutex_unlock(&pool_lock);
+	return 0;
+}
+/* Unmap all slabs.
+ */
+void bufpool_cleanup(void)
+{
+	bufslab_t *slab;
+
+	pthread_mutex_lock(&pool_lock);
+	while(slabs != NULL) {
+		slab = slabs;
+		slabs = slab->next;
+		munmap(slab->mem, BUFPOOL_SLAB);
+		free(slab);
+	}
+	free_list = NULL;
+	memset(&stats, 0, sizeof(stats));
+	pthread_mutex_unlock(&pool_lock);
+}
+/* Get a pool statistics snapshot.
+ */
+void bufpool_get_stats(bufpool_stats_t *st)
+{
+	pthread_mutex_lock(&pool_lock);
+	*st = stats;
+	pthread_mutex_unlock(&pool_lock);
+}
+/* Get an empty buffer.
+ */
+iobuf_t *iobuf_get(void)
+{
+	iobuf_t *b;
+
+	pthread_mutex_lock(&pool_lock);
+	stats.gets++;
+	if(free_list == NULL && bufpool_grow()) {
+		stats.exhausted++;
+		pthread_mutex_unlock(&pool_lock);
+		return NULL;
+	}
+	b = free_list;
+	free_list = b->next;
+	stats.free--;
+	if(stats.total - stats.free > stats.peak)
+		stats.peak = stats.total - stats.free;
+	pthread_mutex_unlock(&pool_lock);
+
+	b->length = 0;
+	b->next = NULL;
+	atomic_store_explicit(&b->refs, 1, memory_order_relaxed);
+	return b;
+}
+/* Take another reference to a buffer.
+ */
+void iobuf_ref(iobuf_t *b)
+{
+	atomic_fetch_add_explicit(&b->refs, 1, memory_order_relaxed);
+}
+/* Drop a reference to a buffer.
+ */
+void iobuf_release(iobuf_t *b)
+{
+	if(b == NULL || atomic_fetch_sub_explicit(&b->refs, 1,
+			memory_order_acq_rel) != 1)
+		return;
+
+	pthread_mutex_lock(&pool_lock);
+	b->next = free_list;
+	free_list = b;
+	stats.free++;
+	pthread_mutex_unlock(&pool_lock);
+}
+/* Drop a reference to every buffer in a chain.
+ */
+void iobuf_release_chain(iobuf_t *b)
+{
+	iobuf_t *next;
+
+	while(b != NULL) {
+		next = b->next;
+		iobuf_release(b);
+		b = next;
+	}
+}
@@ -0,0 +1,65 @@
+/*
+ * bufpool.h - Header for the pooled, refcounted I/O buffers.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ */
+
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Size of each pooled buffer */
+#define BUFPOOL_BUFSIZE 4096
+
+/* Size of a slab of buffers, one huge page */
+#define BUFPOOL_SLAB (2 * 1024 * 1024)
+
+/* Pooled buffer, buffers are chained through next. */
+typedef struct iobuf {
+	char *data;
+	size_t length;
+	struct iobuf *next;
+	_Atomic unsigned int refs;
+} iobuf_t;
+
+/* Span of bytes inside a pooled buffer. */
+typedef struct iospan {
+	iobuf_t *buf;
+	const char *ptr;
+	size_t length;
+} iospan_t;
+
+/* Snapshot of pool statistics. */
+typedef struct bufpool_stats {
+	size_t slabs;
+	size_t huge;
+	size_t total;
+	size_t free;
+	size_t peak;
+	unsigned long long gets;
+	unsigned long long exhausted;
+} bufpool_stats_t;
+
+/* Set up the pool, slabs are mapped on demand up to budget bytes. */
+int bufpool_init(size_t budget, bool huge);
+/* Unmap all slabs, every buffer must have been released. */
+void bufpool_cleanup(void);
+/* Get a pool statistics snapshot. */
+void bufpool_get_stats(bufpool_stats_t *st);
+
+/* Get an empty buffer holding one reference, NULL if the pool is spent. */
+iobuf_t *iobuf_get(void);
+/* Take another reference to a buffer. */
+void iobuf_ref(iobuf_t *b);
+/* Drop a reference, the buffer goes back to the pool with the last one. */
+void iobuf_release(iobuf_t *b);
+/* Drop a reference to every buffer in a chain. */
+void iobuf_release_chain(iobuf_t *b);
+
+#endif
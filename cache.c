@@ -0,0 +1,362 @@
+/*
+ * cache.c - Source for a bounded cache of file variants.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ *
+ * Entries are keyed by path and encoding, and carry the mtime and size of
+ * the file they were made from so a changed file is never served stale.
+ * Least recently used entries are evicted once the byte budget is passed,
+ * entries still being sent stay alive until their last reference goes.
+ *
+ ****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "cache.h"
+
+/* Cache entry, pending until its variant was filled in. */
+struct cache_entry {
+	char *key;
+	int encoding;
+	long long mtime;
+	long long size;
+	char *data;
+	size_t length;
+	size_t cost;
+	unsigned long long hits;
+	int refs;
+	bool pending;
+	bool linked;
+	struct cache_entry *hnext;
+	struct cache_entry *prev;
+	struct cache_entry *next;
+};
+
+/* Main structure for the cache. */
+struct cache {
+	pthread_mutex_t lock;
+	cache_entry_t *buckets[CACHE_BUCKETS];
+	cache_entry_t *head;
+	cache_entry_t *tail;
+	size_t entries;
+	size_t bytes;
+	size_t budget;
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+	unsigned long long original;
+	unsigned long long stored;
+};
+
+/* ---------------------------- Private Functions ------------------------ */
+
+/* Hash a key and encoding.
+ */
+static size_t cache_hash(const char *key, int encoding)
+{
+	unsigned long long h = 14695981039346656037ULL;
+
+	while(*key != '\0') {
+		h ^= (unsigned char)*key++;
+		h *= 1099511628211ULL;
+	}
+	h ^= (unsigned long long)encoding;
+	h *= 1099511628211ULL;
+	return (size_t)(h % CACHE_BUCKETS);
+}
+/* Free an entry.
+ */
+static void cache_entry_free(cache_entry_t *e)
+{
+	if(e != NULL) {
+		free(e->data);
+		free(e->key);
+		free(e);
+	}
+}
+/* Move an entry to the front of the LRU list.
+ */
+static void cache_lru_front(cache_t *c, cache_entry_t *e)
+{
+	if(c->head == e)
+		return;
+
+	/* Unlink */
+	if(e->prev != NULL)
+		e->prev->next = e->next;
+	if(e->next != NULL)
+		e->next->prev = e->prev;
+	if(c->tail == e)
+		c->tail = e->prev;
+
+	/* Push front */
+	e->prev = NULL;
+	e->next = c->head;
+	if(c->head != NULL)
+		c->head->prev = e;
+	c->head = e;
+	if(c->tail == NULL)
+		c->tail = e;
+}
+/* Find an entry in the hash table.
+ */
+static cache_entry_t *cache_find(cache_t *c, const char *key, int encoding,
+	cache_entry_t ***link)
+{
+	cache_entry_t **pe;
+
+	pe = &c->buckets[cache_hash(key, encoding)];
+	while(*pe != NULL) {
+		if((*pe)->encoding == encoding && strcmp((*pe)->key, key) == 0)
+			break;
+		pe = &(*pe)->hnext;
+	}
+	if(link != NULL)
+		*link = pe;
+	return *pe;
+}
+/* Remove an entry from the table, it is freed once unreferenced.
+ */
+static void cache_unlink(cache_t *c, cache_entry_t *e)
+{
+	cache_entry_t **pe;
+
+	cache_find(c, e->key, e->encoding, &pe);
+	if(*pe == e)
+		*pe = e->hnext;
+
+	if(e->prev != NULL)
+		e->prev->next = e->next;
+	else
+		c->head = e->next;
+	if(e->next != NULL)
+		e->next->prev = e->prev;
+	else
+		c->tail = e->prev;
+
+	c->entries--;
+	c->bytes -= e->cost;
+	e->linked = false;
+	if(e->refs == 0)
+		cache_entry_free(e);
+}
+/* Evict least recently used entries until the budget is met.
+ */
+static void cache_evict(cache_t *c)
+{
+	cache_entry_t *e, *prev;
+
+	for(e = c->tail; e != NULL && c->bytes > c->budget; e = prev) {
+		prev = e->prev;
+		if(e->pending)
+			continue;
+		cache_unlink(c, e);
+		c->evictions++;
+	}
+}
+
+/* ----------------------------- Public Functions ------------------------ */
+
+/* Create a cache holding at most budget bytes.
+ */
+cache_t *cache_create(size_t budget)
+{
+	cache_t *c;
+
+	c = calloc(1, sizeof(cache_t));
+	if(c != NULL) {
+		pthread_mutex_init(&c->lock, NULL);
+		c->budget = budget;
+	}
+	return c;
+}
+/* Destroy the cache.
+ */
+void cache_destroy(cache_t *c)
+{
+	if(c == NULL) return;
+
+	pthread_mutex_lock(&c->lock);
+	while(c->head != NULL)
+		cache_unlink(c, c->head);
+	pthread_mutex_unlock(&c->lock);
+	pthread_mutex_destroy(&c->lock);
+	free(c);
+}
+/* Look up a variant of key.
+ */
+cache_entry_t *cache_get(cache_t *c, const char *key, int encoding,
+	long long mtime, long long size, bool *fill)
+{
+	cache_entry_t *e;
+
+	*fill = false;
+	if(c == NULL || key == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&c->lock);
+	e = cache_find(c, key, encoding, NULL);
+	if(e != NULL && (e->mtime != mtime || e->size != size)) {
+		cache_unlink(c, e);
+		e = NULL;
+	}
+
+	if(e != NULL) {
+		cache_lru_front(c, e);
+		if(e->pending || e->data == NULL) {
+			c->misses++;
+			e = NULL;
+		}
+		else {
+			c->hits++;
+			e->hits++;
+			e->refs++;
+		}
+		pthread_mutex_unlock(&c->lock);
+		return e;
+	}
+
+	/* Reserve the slot so only one caller produces the variant */
+	c->misses++;
+	e = calloc(1, sizeof(cache_entry_t));
+	if(e != NULL && (e->key = strdup(key)) != NULL) {
+		cache_entry_t **pe = &c->buckets[cache_hash(key, encoding)];
+
+		e->encoding = encoding;
+		e->mtime = mtime;
+		e->size = size;
+		e->pending = true;
+		e->linked = true;
+		e->cost = sizeof(cache_entry_t) + strlen(key) + 1;
+		e->hnext = *pe;
+		*pe = e;
+		e->next = c->head;
+		if(c->head != NULL)
+			c->head->prev = e;
+		c->head = e;
+		if(c->tail == NULL)
+			c->tail = e;
+		c->entries++;
+		c->bytes += e->cost;
+		*fill = true;
+	}
+	else {
+		free(e);
+	}
+	pthread_mutex_unlock(&c->lock);
+	return NULL;
+}
+/* Store a variant reserved by cache_get().
+ */
+void cache_fill(cache_t *c, const char *key, int encoding, long long mtime,
+	long long size, char *data, size_t length)
+{
+	cache_entry_t *e;
+
+	if(c == NULL || key == NULL) {
+		free(data);
+		return;
+	}
+
+	pthread_mutex_lock(&c->lock);
+	e = cache_find(c, key, encoding, NULL);
+	if(e == NULL || !e->pending || e->mtime != mtime || e->size != size) {
+		pthread_mutex_unlock(&c->lock);
+		free(data);
+		return;
+	}
+
+	e->pending = false;
+	if(data != NULL) {
+		e->data = data;
+		e->length = length;
+		e->cost += length;
+		c->bytes += length;
+		c->original += size;
+		c->stored += length;
+	}
+	cache_evict(c);
+	pthread_mutex_unlock(&c->lock);
+}
+/* Release an entry returned by cache_get().
+ */
+void cache_release(cache_t *c, cache_entry_t *e)
+{
+	if(c == NULL || e == NULL) return;
+
+	pthread_mutex_lock(&c->lock);
+	if(--e->refs == 0 && !e->linked)
+		cache_entry_free(e);
+	pthread_mutex_unlock(&c->lock);
+}
+/* Get entry data.
+ */
+const char *cache_entry_data(cache_entry_t *e)
+{
+	return e != NULL ? e->data : NULL;
+}
+/* Get entry data length.
+ */
+size_t cache_entry_length(cache_entry_t *e)
+{
+	return e != NULL ? e->length : 0;
+}
+/* Copy the keys of the most used entries, busiest first.
+ */
+size_t cache_hottest(cache_t *c, cache_hot_t *hot, size_t max)
+{
+	cache_entry_t *e;
+	size_t i, n = 0;
+
+	if(c == NULL || max == 0)
+		return 0;
+
+	/* Keep the top max by hits, ties go to the most recently used */
+	pthread_mutex_lock(&c->lock);
+	for(e = c->head; e != NULL; e = e->next) {
+		if(e->pending || e->data == NULL || e->hits == 0)
+			continue;
+		if(n == max && e->hits <= hot[n-1].hits)
+			continue;
+		if(n == max)
+			free(hot[--n].key);
+		for(i = n; i > 0 && hot[i-1].hits < e->hits; i--)
+			hot[i] = hot[i-1];
+		hot[i].key = strdup(e->key);
+		if(hot[i].key == NULL) {
+			memmove(&hot[i], &hot[i+1], sizeof(cache_hot_t) * (n - i));
+			continue;
+		}
+		hot[i].encoding = e->encoding;
+		hot[i].hits = e->hits;
+		n++;
+	}
+	pthread_mutex_unlock(&c->lock);
+	return n;
+}
+/* Get a statistics snapshot.
+ */
+void cache_get_stats(cache_t *c, cache_stats_t *st)
+{
+	if(st == NULL) return;
+	memset(st, 0, sizeof(cache_stats_t));
+	if(c == NULL) return;
+
+	pthread_mutex_lock(&c->lock);
+	st->entries = c->entries;
+	st->bytes = c->bytes;
+	st->budget = c->budget;
+	st->hits = c->hits;
+	st->misses = c->misses;
+	st->evictions = c->evictions;
+	st->original = c->original;
+	st->stored = c->stored;
+	pthread_mutex_unlock(&c->lock);
+}
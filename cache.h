@@ -0,0 +1,81 @@
+/*
+ * cache.h - Header for a bounded cache of file variants.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Hash buckets in each cache */
+#define CACHE_BUCKETS 1024
+
+/* Encodings an entry can hold */
+enum {
+	CACHE_IDENTITY,
+	CACHE_GZIP
+};
+
+/* Forward declaration of structs and define typedefs. */
+struct cache;
+typedef struct cache cache_t;
+struct cache_entry;
+typedef struct cache_entry cache_entry_t;
+
+/* Snapshot of cache statistics. */
+typedef struct cache_stats {
+	size_t entries;
+	size_t bytes;
+	size_t budget;
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+	unsigned long long original;
+	unsigned long long stored;
+} cache_stats_t;
+
+/* Entry reported by cache_hottest(). */
+typedef struct cache_hot {
+	char *key;
+	int encoding;
+	unsigned long long hits;
+} cache_hot_t;
+
+/* Create a cache holding at most budget bytes. */
+cache_t *cache_create(size_t budget);
+
+/* Destroy the cache, entries still referenced are freed on release. */
+void cache_destroy(cache_t *c);
+
+/* Look up a variant of key whose file has the given mtime and size. On a
+ * miss fill is set when the caller should produce the variant and hand it
+ * to cache_fill(), a hit returns an entry the caller must release. */
+cache_entry_t *cache_get(cache_t *c, const char *key, int encoding,
+	long long mtime, long long size, bool *fill);
+
+/* Store a variant reserved by cache_get(), the cache takes ownership of
+ * malloc'd data. NULL data records that the variant is not worth keeping. */
+void cache_fill(cache_t *c, const char *key, int encoding, long long mtime,
+	long long size, char *data, size_t length);
+
+/* Release an entry returned by cache_get(). */
+void cache_release(cache_t *c, cache_entry_t *e);
+
+/* Get entry data and its length. */
+const char *cache_entry_data(cache_entry_t *e);
+size_t cache_entry_length(cache_entry_t *e);
+
+/* Copy the keys of up to max of the most used entries into hot, busiest
+ * first. Returns the number copied, the caller frees each key. */
+size_t cache_hottest(cache_t *c, cache_hot_t *hot, size_t max);
+
+/* Get a statistics snapshot. */
+void cache_get_stats(cache_t *c, cache_stats_t *st);
+
+#endif
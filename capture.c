@@ -0,0 +1,197 @@
+/*
+ * capture.c - Source for recording request traffic to a binary trace.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ *
+ * A trace is the magic string followed by one record per request: arrival
+ * time in microseconds since capture started (u64), connection number
+ * (u32), flags (u8), request line length (u16) and host length (u8), all
+ * little-endian, then the request line and host bytes. Records are appended
+ * under a lock through a large stdio buffer, so a request costs a memcpy
+ * most times.
+ *
+ ****************************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "capture.h"
+
+/* Size of the fixed part of a record */
+#define CAPTURE_RECORD_SIZE 16
+
+/* Size of the stdio buffer used for writing */
+#define CAPTURE_BUFSIZE (1 << 20)
+
+static FILE *out;
+static char *outbuf;
+static uint64_t started;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* ---------------------------- Private Functions ------------------------ */
+
+/* Get monotonic time in microseconds.
+ */
+static uint64_t capture_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+/* Store value in size bytes, least significant first.
+ */
+static void capture_put(unsigned char *p, uint64_t value, int size)
+{
+	int i;
+
+	for(i = 0; i < size; i++)
+		p[i] = (unsigned char)(value >> (i * 8));
+}
+/* Load a value stored with capture_put().
+ */
+static uint64_t capture_get(const unsigned char *p, int size)
+{
+	uint64_t value = 0;
+	int i;
+
+	for(i = size - 1; i >= 0; i--)
+		value = value << 8 | p[i];
+	return value;
+}
+
+/* ----------------------------- Public Functions ------------------------ */
+
+/* Start writing a trace to path.
+ */
+int capture_open(const char *path)
+{
+	return capture_resume(path, 0);
+}
+/* Append to a trace started at the given time.
+ */
+int capture_resume(const char *path, uint64_t start)
+{
+	char *buf;
+	FILE *fp;
+
+	fp = fopen(path, start != 0 ? "abe" : "wbe");
+	if(fp == NULL)
+		return -1;
+	buf = malloc(CAPTURE_BUFSIZE);
+	if(buf != NULL)
+		setvbuf(fp, buf, _IOFBF, CAPTURE_BUFSIZE);
+
+	/* Appending to a trace that was never started needs the magic too */
+	if(fseek(fp, 0, SEEK_END) || (ftell(fp) == 0 && fwrite(CAPTURE_MAGIC,
+			1, strlen(CAPTURE_MAGIC), fp) != strlen(CAPTURE_MAGIC))) {
+		fclose(fp);
+		free(buf);
+		return -1;
+	}
+
+	/* Workers may be recording already when resumed after an upgrade */
+	pthread_mutex_lock(&lock);
+	started = start != 0 ? start : capture_now();
+	out = fp;
+	outbuf = buf;
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+/* Get the time the trace started at.
+ */
+uint64_t capture_started(void)
+{
+	return out != NULL ? started : 0;
+}
+/* Flush and close the trace.
+ */
+void capture_close(void)
+{
+	pthread_mutex_lock(&lock);
+	if(out != NULL) {
+		if(fclose(out))
+			fprintf(stderr, "Error: Cannot write capture.\n");
+		out = NULL;
+	}
+	free(outbuf);
+	outbuf = NULL;
+	pthread_mutex_unlock(&lock);
+}
+/* Check if a trace is being written.
+ */
+bool capture_enabled(void)
+{
+	return out != NULL;
+}
+/* Record a request line and host.
+ */
+void capture_request(uint32_t conn, const char *line, size_t length,
+	const char *host, size_t host_length, bool keep)
+{
+	unsigned char head[CAPTURE_RECORD_SIZE];
+	uint64_t now = capture_now();
+
+	if(length > CAPTURE_LINE_MAX)
+		return;
+	if(host_length > CAPTURE_HOST_MAX)
+		host_length = 0;
+
+	capture_put(head + 8, conn, 4);
+	capture_put(head + 12, keep ? CAPTURE_KEEP : 0, 1);
+	capture_put(head + 13, length, 2);
+	capture_put(head + 15, host_length, 1);
+
+	pthread_mutex_lock(&lock);
+	if(out != NULL) {
+		capture_put(head, now - started, 8);
+		fwrite(head, 1, sizeof(head), out);
+		fwrite(line, 1, length, out);
+		if(host_length > 0)
+			fwrite(host, 1, host_length, out);
+	}
+	pthread_mutex_unlock(&lock);
+}
+/* Check the header of a trace opened for reading.
+ */
+int capture_check(FILE *fp)
+{
+	char magic[sizeof(CAPTURE_MAGIC)];
+
+	if(fread(magic, 1, strlen(CAPTURE_MAGIC), fp) != strlen(CAPTURE_MAGIC) ||
+			memcmp(magic, CAPTURE_MAGIC, strlen(CAPTURE_MAGIC)) != 0)
+		return -1;
+	return 0;
+}
+/* Read the next record.
+ */
+int capture_read(FILE *fp, capture_record_t *rec)
+{
+	unsigned char head[CAPTURE_RECORD_SIZE];
+	size_t n, length, host_length;
+
+	n = fread(head, 1, sizeof(head), fp);
+	if(n == 0)
+		return 0;
+	if(n != sizeof(head))
+		return -1;
+
+	rec->usec = capture_get(head, 8);
+	rec->conn = (uint32_t)capture_get(head + 8, 4);
+	rec->flags = (uint8_t)capture_get(head + 12, 1);
+	length = capture_get(head + 13, 2);
+	host_length = capture_get(head + 15, 1);
+	if(length > CAPTURE_LINE_MAX ||
+			fread(rec->line, 1, length, fp) != length ||
+			fread(rec->host, 1, host_length, fp) != host_length)
+		return -1;
+	rec->line[length] = '\0';
+	rec->host[host_length] = '\0';
+	return 1;
+}
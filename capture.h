@@ -0,0 +1,61 @@
+/*
+ * capture.h - Header for recording request traffic to a binary trace.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Identifies a trace file and its layout */
+#define CAPTURE_MAGIC "SHTCAP01"
+
+/* Longest request line and host kept in a record */
+#define CAPTURE_LINE_MAX 2048
+#define CAPTURE_HOST_MAX 255
+
+/* Record flags */
+#define CAPTURE_KEEP 0x01
+
+/* One recorded request. */
+typedef struct capture_record {
+	uint64_t usec;
+	uint32_t conn;
+	uint8_t flags;
+	char line[CAPTURE_LINE_MAX + 1];
+	char host[CAPTURE_HOST_MAX + 1];
+} capture_record_t;
+
+/* Start writing a trace to path. */
+int capture_open(const char *path);
+/* Append to a trace whose times count from start, a monotonic time in
+ * microseconds from capture_started(). A start of 0 begins a new trace. */
+int capture_resume(const char *path, uint64_t start);
+/* Get the time the trace being written started at, 0 when not capturing. */
+uint64_t capture_started(void);
+/* Flush and close the trace. */
+void capture_close(void);
+
+/* Check if a trace is being written. */
+bool capture_enabled(void);
+
+/* Record a request line and host that arrived on connection conn, keep
+ * tells if the client asked for the connection to stay open. */
+void capture_request(uint32_t conn, const char *line, size_t length,
+	const char *host, size_t host_length, bool keep);
+
+/* Check the header of a trace opened for reading. */
+int capture_check(FILE *fp);
+/* Read the next record, returns 1 on success, 0 at the end or -1 when the
+ * trace is damaged. */
+int capture_read(FILE *fp, capture_record_t *rec);
+
+#endif
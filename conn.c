@@ -0,0 +1,311 @@
+/*
+ * conn.c - Source for tracking idle keep-alive connections.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ *
+ * A connection between requests is parked in an epoll set owned by the
+ * accept loop, so it holds neither a worker nor a buffer. Descriptors are
+ * armed one-shot, the accept loop is the only thread that takes a parked
+ * connection out again, either to run its next request or to time it out.
+ * A worker parks in two steps, the sweep only closes a connection once it
+ * is fully parked and takes it over with a compare and swap first.
+ *
+ ****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/epoll.h>
+
+#include "conn.h"
+
+/* Connection states */
+enum {
+	CONN_FREE,
+	CONN_BUSY,
+	CONN_PARKING,
+	CONN_IDLE,
+	CONN_CLOSING
+};
+
+/* Connection slot, indexed by descriptor. */
+typedef struct conn {
+	_Atomic int state;
+	bool armed;
+	time_t since;
+	unsigned int requests;
+	uint32_t id;
+	union {
+		struct sockaddr sa;
+		struct sockaddr_in in;
+		struct sockaddr_in6 in6;
+	} peer;
+} conn_t;
+
+static conn_t *conns;
+static int epfd = -1;
+static SOCKET listener = INVALID_SOCKET;
+static _Atomic size_t nopen;
+static _Atomic size_t nidle;
+static _Atomic unsigned long long nreused;
+static unsigned long long ntimeouts;
+static uint32_t next_id;
+
+/* ---------------------------- Private Functions ------------------------ */
+
+/* Get the slot for a descriptor.
+ */
+static conn_t *conn_get(SOCKET fd)
+{
+	return (conns != NULL && fd >= 0 && fd < CONN_MAX) ? &conns[fd] : NULL;
+}
+/* Forget a connection and close it.
+ */
+static void conn_drop(SOCKET fd, conn_t *c)
+{
+	if(c != NULL) {
+		if(atomic_exchange(&c->state, CONN_FREE) != CONN_FREE)
+			nopen--;
+		c->armed = false;
+	}
+	close(fd);
+}
+/* Close connections idle for more than limit seconds.
+ */
+static void conn_sweep_older(time_t limit)
+{
+	time_t now = time(NULL);
+	int fd, state;
+
+	if(conns == NULL)
+		return;
+	for(fd = 0; fd < CONN_MAX; fd++) {
+		state = CONN_IDLE;
+		if(atomic_load(&conns[fd].state) == CONN_IDLE &&
+				now - conns[fd].since >= limit &&
+				atomic_compare_exchange_strong(&conns[fd].state, &state,
+					CONN_CLOSING)) {
+			nidle--;
+			ntimeouts++;
+			conn_drop(fd, &conns[fd]);
+		}
+	}
+}
+
+/* ----------------------------- Public Functions ------------------------ */
+
+/* Set up tracking.
+ */
+int conn_init(SOCKET server)
+{
+	struct epoll_event ev;
+
+	conns = calloc(CONN_MAX, sizeof(conn_t));
+	if(conns == NULL)
+		return -1;
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(epfd < 0) {
+		free(conns);
+		conns = NULL;
+		return -1;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.fd = server;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, server, &ev)) {
+		conn_cleanup();
+		return -1;
+	}
+	listener = server;
+	return 0;
+}
+/* Close idle connections and stop tracking.
+ */
+void conn_cleanup(void)
+{
+	int fd;
+
+	if(conns != NULL) {
+		for(fd = 0; fd < CONN_MAX; fd++)
+			if(conns[fd].state == CONN_IDLE)
+				conn_drop(fd, &conns[fd]);
+		free(conns);
+		conns = NULL;
+	}
+	if(epfd >= 0)
+		close(epfd);
+	epfd = -1;
+	listener = INVALID_SOCKET;
+}
+/* Wait for idle connections with a new request.
+ */
+int conn_wait(SOCKET *fds, int max, bool *accept, int timeout)
+{
+	struct epoll_event events[64];
+	int i, n, state, count = 0;
+	conn_t *c;
+
+	*accept = false;
+	if(max > 64)
+		max = 64;
+	n = epoll_wait(epfd, events, max, timeout);
+	if(n < 0)
+		return errno == EINTR ? 0 : -1;
+
+	for(i = 0; i < n; i++) {
+		if(events[i].data.fd == listener) {
+			*accept = true;
+			continue;
+		}
+		c = conn_get(events[i].data.fd);
+		if(c == NULL)
+			continue;
+
+		/* The request may come before the worker finished parking */
+		state = CONN_IDLE;
+		if(atomic_compare_exchange_strong(&c->state, &state, CONN_BUSY) ||
+				(state == CONN_PARKING && atomic_compare_exchange_strong(
+				&c->state, &state, CONN_BUSY))) {
+			nidle--;
+			fds[count++] = events[i].data.fd;
+		}
+	}
+	return count;
+}
+/* Close connections idle for too long.
+ */
+void conn_sweep(void)
+{
+	conn_sweep_older(CONN_IDLE_TIMEOUT + 1);
+}
+/* Close every idle connection.
+ */
+void conn_close_idle(void)
+{
+	conn_sweep_older(0);
+}
+/* Stop watching the listening socket.
+ */
+void conn_stop_accept(void)
+{
+	if(epfd >= 0 && listener != INVALID_SOCKET)
+		epoll_ctl(epfd, EPOLL_CTL_DEL, listener, NULL);
+	listener = INVALID_SOCKET;
+}
+/* Start tracking a newly accepted connection.
+ */
+void conn_open(SOCKET fd, const struct sockaddr *peer)
+{
+	conn_t *c = conn_get(fd);
+
+	if(c != NULL) {
+		memset(&c->peer, 0, sizeof(c->peer));
+		if(peer != NULL && peer->sa_family == AF_INET)
+			memcpy(&c->peer, peer, sizeof(struct sockaddr_in));
+		else if(peer != NULL && peer->sa_family == AF_INET6)
+			memcpy(&c->peer, peer, sizeof(struct sockaddr_in6));
+		c->requests = 0;
+		c->armed = false;
+		c->id = ++next_id;
+		if(c->id == 0)
+			c->id = ++next_id;
+		atomic_store(&c->state, CONN_BUSY);
+		nopen++;
+	}
+}
+/* Count a request on a connection.
+ */
+bool conn_begin(SOCKET fd)
+{
+	conn_t *c = conn_get(fd);
+
+	if(c == NULL)
+		return false;
+	if(c->requests++ > 0)
+		nreused++;
+	return c->requests < CONN_MAX_REQUESTS;
+}
+/* Park the connection until its next request or close it.
+ */
+void conn_finish(SOCKET fd, bool keep)
+{
+	conn_t *c = conn_get(fd);
+	struct epoll_event ev;
+	int op, state;
+
+	if(!keep || c == NULL || epfd < 0) {
+		conn_drop(fd, c);
+		return;
+	}
+
+	/* Mark parking first, the next request may arrive before epoll_ctl
+	 * returns and the accept loop may take it then, but never close it
+	 */
+	c->since = time(NULL);
+	nidle++;
+	atomic_store(&c->state, CONN_PARKING);
+	ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+	ev.data.fd = fd;
+	op = c->armed ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	c->armed = true;
+	if(epoll_ctl(epfd, op, fd, &ev) == 0) {
+		/* Only idle once armed, unless already taken for a request */
+		state = CONN_PARKING;
+		atomic_compare_exchange_strong(&c->state, &state, CONN_IDLE);
+		return;
+	}
+
+	/* Nothing was armed, so the accept loop can't have taken it */
+	atomic_store(&c->state, CONN_BUSY);
+	nidle--;
+	conn_drop(fd, c);
+}
+/* Get the number the next accepted connection will get.
+ */
+uint32_t conn_next_id(void)
+{
+	return next_id + 1;
+}
+/* Continue numbering connections from id.
+ */
+void conn_set_next_id(uint32_t id)
+{
+	next_id = id - 1;
+}
+/* Get the address a connection was accepted from.
+ */
+const struct sockaddr *conn_peer(SOCKET fd)
+{
+	conn_t *c = conn_get(fd);
+
+	return c != NULL && c->peer.sa.sa_family != AF_UNSPEC ? &c->peer.sa : NULL;
+}
+/* Get the number given to a connection when it was accepted.
+ */
+uint32_t conn_id(SOCKET fd)
+{
+	conn_t *c = conn_get(fd);
+
+	return c != NULL ? c->id : 0;
+}
+/* Close a connection.
+ */
+void conn_close(SOCKET fd)
+{
+	conn_drop(fd, conn_get(fd));
+}
+/* Get a snapshot of connection counters.
+ */
+void conn_get_stats(conn_stats_t *st)
+{
+	st->open = nopen;
+	st->idle = nidle;
+	st->reused = nreused;
+	st->timeouts = ntimeouts;
+}
@@ -0,0 +1,77 @@
+/*
+ * conn.h - Header for tracking idle keep-alive connections.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ */
+
+#ifndef CONN_H
+#define CONN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "network.h"
+
+/* Highest descriptor that may be kept alive */
+#define CONN_MAX 65536
+
+/* Seconds an idle connection is kept open */
+#define CONN_IDLE_TIMEOUT 5
+
+/* Most requests served on one connection */
+#define CONN_MAX_REQUESTS 100
+
+/* Snapshot of connection counters. */
+typedef struct conn_stats {
+	size_t open;
+	size_t idle;
+	unsigned long long reused;
+	unsigned long long timeouts;
+} conn_stats_t;
+
+/* Set up tracking, the listening socket is watched along with idle
+ * connections. */
+int conn_init(SOCKET server);
+/* Close idle connections and stop tracking. */
+void conn_cleanup(void);
+
+/* Wait for idle connections with a new request, up to timeout
+ * milliseconds. Stores up to max of them in fds and sets accept if the
+ * listening socket is ready. Returns the number stored or -1 on error. */
+int conn_wait(SOCKET *fds, int max, bool *accept, int timeout);
+/* Close connections idle for longer than CONN_IDLE_TIMEOUT. */
+void conn_sweep(void);
+/* Close every idle connection. */
+void conn_close_idle(void);
+/* Stop watching the listening socket, so conn_wait() only returns
+ * connections. */
+void conn_stop_accept(void);
+
+/* Start tracking a newly accepted connection and the address it came
+ * from. */
+void conn_open(SOCKET fd, const struct sockaddr *peer);
+/* Count a request on a connection, returns false once the connection has
+ * served CONN_MAX_REQUESTS. */
+bool conn_begin(SOCKET fd);
+/* Park the connection until its next request or close it. */
+void conn_finish(SOCKET fd, bool keep);
+/* Get the number the next accepted connection will get. */
+uint32_t conn_next_id(void);
+/* Continue numbering connections from id, after an upgrade. */
+void conn_set_next_id(uint32_t id);
+/* Get the address a connection was accepted from, NULL when unknown. */
+const struct sockaddr *conn_peer(SOCKET fd);
+/* Get the number given to a connection when it was accepted, 0 when it
+ * isn't tracked. */
+uint32_t conn_id(SOCKET fd);
+/* Close a connection. */
+void conn_close(SOCKET fd);
+
+/* Get a snapshot of connection counters. */
+void conn_get_stats(conn_stats_t *st);
+
+#endif
@@ -14,6 +14,10 @@
 #define TCPSOCKET_BACKLOG 32
 #endif
 
+#ifndef SOCKET_TIMEOUT
+#define SOCKET_TIMEOUT 5000
+#endif
+
 #include <string.h>
 #include <errno.h>
 
@@ -26,9 +30,12 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
 #endif
 
 /* Open a server socket and bind.
@@ -68,9 +75,9 @@ static SOCKET socket_connect(char *server_name, unsigned short port)
 
 	return fd;
 }
-/* Open a server that will accept TCP connections.
+/* Open a server that will accept TCP connections with given backlog.
  */
-static SOCKET server_socket_open(unsigned short *port)
+static SOCKET server_socket_open_backlog(unsigned short *port, int backlog)
 {
 	struct sockaddr_in addr;
 	socklen_t addrlen;
@@ -92,7 +99,7 @@ static SOCKET server_socket_open(unsigned short *port)
 	}
 
 	/* Listen for client connections. */
-	if(listen(fd, TCPSOCKET_BACKLOG)) {
+	if(listen(fd, backlog > 0 ? backlog : TCPSOCKET_BACKLOG)) {
 		close(fd);
 		return -1;
 	}
@@ -110,6 +117,12 @@ static SOCKET server_socket_open(unsigned short *port)
 	/* Return the server socket */
 	return fd;
 }
+/* Open a server that will accept TCP connections.
+ */
+static SOCKET server_socket_open(unsigned short *port)
+{
+	return server_socket_open_backlog(port, TCPSOCKET_BACKLOG);
+}
 /* Accept an incoming connection from a server socket.
  */
 static SOCKET server_socket_accept(SOCKET server_fd)
@@ -132,6 +145,218 @@ static SOCKET server_socket_accept(SOCKET server_fd)
 
 	return client_fd;
 }
+/* Accept every pending connection from a non-blocking server socket
+ * without waiting. Peer addresses are stored in addrs unless it is NULL.
+ * Returns number of sockets stored in fds or -1 on error.
+ */
+static int server_socket_accept_ready(SOCKET server_fd, SOCKET *fds,
+	struct sockaddr_storage *addrs, int max)
+{
+	socklen_t addrlen;
+	SOCKET client_fd;
+	int count = 0;
+
+	/* Drain the backlog until it would block */
+	while(count < max) {
+		addrlen = sizeof(struct sockaddr_storage);
+		client_fd = accept4(server_fd,
+			addrs != NULL ? (struct sockaddr *)&addrs[count] : NULL,
+			addrs != NULL ? &addrlen : NULL,
+			SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(client_fd == INVALID_SOCKET) {
+			if(errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK || count > 0)
+				break;
+			return -1;
+		}
+		fds[count++] = client_fd;
+	}
+	return count;
+}
+/* Accept every pending connection from a non-blocking server socket,
+ * blocking only until the first one arrives. Peer addresses are stored
+ * in addrs unless it is NULL. Returns number of sockets stored in fds or
+ * -1 on error.
+ */
+static int server_socket_accept_batch(SOCKET server_fd, SOCKET *fds,
+	struct sockaddr_storage *addrs, int max)
+{
+	struct pollfd pfd;
+
+	pfd.fd = server_fd;
+	pfd.events = POLLIN;
+	if(poll(&pfd, 1, -1) < 0)
+		return errno == EINTR ? 0 : -1;
+	return server_socket_accept_ready(server_fd, fds, addrs, max);
+}
+/* Set a socket to non-blocking mode.
+ */
+static int socket_set_nonblock(SOCKET fd)
+{
+	int flags;
+
+	flags = fcntl(fd, F_GETFL, 0);
+	if(flags < 0)
+		return -1;
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+/* Wait for a socket to become ready, returns 0 on timeout.
+ */
+static int socket_wait(SOCKET fd, short events, int timeout)
+{
+	struct pollfd pfd;
+	int rc;
+
+	pfd.fd = fd;
+	pfd.events = events;
+	do {
+		rc = poll(&pfd, 1, timeout);
+	} while(rc < 0 && errno == EINTR);
+	return rc;
+}
+/* Receive from a non-blocking socket, waiting up to timeout milliseconds.
+ */
+static long socket_recv_timeout(SOCKET fd, void *buf, size_t size,
+	int timeout)
+{
+	long nbytes;
+
+	for(;;) {
+		nbytes = recv(fd, buf, size, 0);
+		if(nbytes >= 0)
+			return nbytes;
+		if(errno == EINTR)
+			continue;
+		if(errno != EAGAIN && errno != EWOULDBLOCK)
+			return -1;
+		nbytes = socket_wait(fd, POLLIN, timeout);
+		if(nbytes <= 0) {
+			if(nbytes == 0)
+				errno = ETIMEDOUT;
+			return -1;
+		}
+	}
+}
+/* Receive from a non-blocking socket, waiting up to SOCKET_TIMEOUT.
+ */
+static long socket_recv(SOCKET fd, void *buf, size_t size)
+{
+	return socket_recv_timeout(fd, buf, size, SOCKET_TIMEOUT);
+}
+/* Send all data on a non-blocking socket, waiting up to SOCKET_TIMEOUT
+ * each time the socket buffer is full.
+ */
+static long socket_send_all(SOCKET fd, const void *buf, size_t size)
+{
+	const char *p = (const char *)buf;
+	size_t sent = 0;
+	long nbytes;
+
+	while(sent < size) {
+		nbytes = send(fd, p + sent, size - sent, MSG_NOSIGNAL);
+		if(nbytes > 0) {
+			sent += nbytes;
+			continue;
+		}
+		if(nbytes < 0 && errno == EINTR)
+			continue;
+		if(nbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if(socket_wait(fd, POLLOUT, SOCKET_TIMEOUT) > 0)
+				continue;
+		}
+		return sent > 0 ? (long)sent : -1;
+	}
+	return (long)sent;
+}
+/* Send all data described by iov on a non-blocking socket with as few
+ * system calls as possible, iov is updated as data goes out.
+ */
+static long socket_sendv_all(SOCKET fd, struct iovec *iov, int count)
+{
+	struct msghdr msg;
+	size_t sent = 0;
+	long nbytes;
+
+	memset(&msg, 0, sizeof(msg));
+	while(count > 0) {
+		/* Skip fully sent buffers */
+		if(iov->iov_len == 0) {
+			iov++;
+			count--;
+			continue;
+		}
+
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+		nbytes = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if(nbytes < 0) {
+			if(errno == EINTR)
+				continue;
+			if((errno == EAGAIN || errno == EWOULDBLOCK) &&
+					socket_wait(fd, POLLOUT, SOCKET_TIMEOUT) > 0)
+				continue;
+			return sent > 0 ? (long)sent : -1;
+		}
+
+		sent += nbytes;
+		while(count > 0 && (size_t)nbytes >= iov->iov_len) {
+			nbytes -= iov->iov_len;
+			iov->iov_len = 0;
+			iov++;
+			count--;
+		}
+		if(count > 0) {
+			iov->iov_base = (char *)iov->iov_base + nbytes;
+			iov->iov_len -= nbytes;
+		}
+	}
+	return (long)sent;
+}
+/* Connect to an address, the socket is returned non-blocking.
+ */
+static SOCKET socket_connect_addr(const struct sockaddr_in *addr)
+{
+	socklen_t len;
+	SOCKET fd;
+	int err = 0;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fd == INVALID_SOCKET)
+		return -1;
+
+	/* Wait up to SOCKET_TIMEOUT for the connection to complete */
+	if(connect(fd, (const struct sockaddr *)addr, sizeof(struct sockaddr_in))) {
+		if(errno != EINPROGRESS) {
+			close(fd);
+			return -1;
+		}
+		len = sizeof(err);
+		if(socket_wait(fd, POLLOUT, SOCKET_TIMEOUT) <= 0 ||
+				getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+			close(fd);
+			errno = err ? err : ETIMEDOUT;
+			return -1;
+		}
+	}
+
+	return fd;
+}
+/* Get the CPU that received a socket's last packet, -1 if unknown.
+ */
+static int socket_incoming_cpu(SOCKET fd)
+{
+#ifdef SO_INCOMING_CPU
+	socklen_t len = sizeof(int);
+	int cpu;
+
+	if(getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0)
+		return cpu;
+#else
+	(void)fd;
+#endif
+	return -1;
+}
 /* Get IP address from address structure.
  */
 static void *get_addr_in(struct sockaddr *sa)
@@ -0,0 +1,126 @@
+/*
+ * pipeline.c - Source for queueing responses to pipelined requests.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ *
+ * Responses are queued in the order their requests arrived and go out in
+ * one sendmsg() once every request already received was answered. Heads
+ * are copied into one append buffer, bodies are only referenced and given
+ * back through their release callback after the batch was sent.
+ *
+ ****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+
+/* ---------------------------- Private Functions ------------------------ */
+
+/* Give every queued body back and empty the queue.
+ */
+static void pipeline_release(pipeline_t *pl)
+{
+	int i;
+
+	for(i = 0; i < pl->count; i++)
+		if(pl->items[i].release != NULL)
+			pl->items[i].release(pl->items[i].arg, pl->items[i].data);
+	ab_free(pl->heads);
+	pl->heads = NULL;
+	pl->count = 0;
+	pl->bytes = 0;
+}
+
+/* ----------------------------- Public Functions ------------------------ */
+
+/* Set up an empty queue for a connection.
+ */
+void pipeline_init(pipeline_t *pl, SOCKET fd)
+{
+	memset(pl, 0, sizeof(pipeline_t));
+	pl->fd = fd;
+}
+/* Drop anything still queued and free the queue.
+ */
+void pipeline_free(pipeline_t *pl)
+{
+	pipeline_release(pl);
+}
+/* Queue a response head and optional body.
+ */
+int pipeline_push(pipeline_t *pl, const char *head, size_t hlen,
+	const char *body, size_t length, pipeline_release_t release, void *arg,
+	void *data)
+{
+	pipeline_item_t *item;
+
+	if(pl->heads == NULL)
+		pl->heads = ab_init();
+	if(pl->failed || pl->count == PIPELINE_MAX || pl->heads == NULL) {
+		if(release != NULL)
+			release(arg, data);
+		return -1;
+	}
+
+	item = &pl->items[pl->count];
+	item->head = ab_getsize(pl->heads);
+	if(ab_append(pl->heads, head, hlen) < 0) {
+		if(release != NULL)
+			release(arg, data);
+		return -1;
+	}
+	item->hlen = hlen;
+	item->body = body;
+	item->length = length;
+	item->release = release;
+	item->arg = arg;
+	item->data = data;
+	pl->count++;
+	pl->bytes += length;
+	return 0;
+}
+/* Check if the queue should be flushed before more is added.
+ */
+bool pipeline_full(const pipeline_t *pl)
+{
+	return pl->count == PIPELINE_MAX || pl->bytes >= PIPELINE_MAX_BYTES;
+}
+/* Send everything queued in one batch.
+ */
+long pipeline_flush(pipeline_t *pl)
+{
+	struct iovec iov[PIPELINE_MAX * 2];
+	size_t total = 0;
+	long nbytes;
+	int i, n = 0;
+
+	if(pl->failed) {
+		pipeline_release(pl);
+		return -1;
+	}
+	if(pl->count == 0)
+		return 0;
+
+	/* Heads can't move anymore, so point into them now */
+	for(i = 0; i < pl->count; i++) {
+		iov[n].iov_base = ab_getdata(pl->heads) + pl->items[i].head;
+		iov[n++].iov_len = pl->items[i].hlen;
+		if(pl->items[i].length > 0) {
+			iov[n].iov_base = (void *)pl->items[i].body;
+			iov[n++].iov_len = pl->items[i].length;
+		}
+		total += pl->items[i].hlen + pl->items[i].length;
+	}
+
+	nbytes = socket_sendv_all(pl->fd, iov, n);
+	if(nbytes != (long)total)
+		pl->failed = true;
+	pipeline_release(pl);
+	return pl->failed ? -1 : nbytes;
+}
@@ -0,0 +1,68 @@
+/*
+ * pipeline.h - Header for queueing responses to pipelined requests.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "abuffer.h"
+#include "network.h"
+
+/* Most responses outstanding on one connection */
+#define PIPELINE_MAX 16
+
+/* Queued body bytes that make the batch flush early */
+#define PIPELINE_MAX_BYTES (256 * 1024)
+
+/* Called once a queued body was sent or dropped. */
+typedef void (*pipeline_release_t)(void *arg, void *data);
+
+/* Response waiting to be sent. */
+typedef struct pipeline_item {
+	size_t head;
+	size_t hlen;
+	const char *body;
+	size_t length;
+	pipeline_release_t release;
+	void *arg;
+	void *data;
+} pipeline_item_t;
+
+/* Responses queued in request order for one connection. */
+typedef struct pipeline {
+	SOCKET fd;
+	AppendBuffer *heads;
+	pipeline_item_t items[PIPELINE_MAX];
+	int count;
+	size_t bytes;
+	bool failed;
+} pipeline_t;
+
+/* Set up an empty queue for a connection. */
+void pipeline_init(pipeline_t *pl, SOCKET fd);
+/* Drop anything still queued and free the queue. */
+void pipeline_free(pipeline_t *pl);
+
+/* Queue a response head and optional body, release is called with arg and
+ * data once the body isn't needed anymore. Returns -1 if the queue is full
+ * or out of memory, release has been called then. */
+int pipeline_push(pipeline_t *pl, const char *head, size_t hlen,
+	const char *body, size_t length, pipeline_release_t release, void *arg,
+	void *data);
+
+/* Check if the queue should be flushed before more is added. */
+bool pipeline_full(const pipeline_t *pl);
+
+/* Send everything queued in one batch, returns bytes sent or -1 when the
+ * connection failed. */
+long pipeline_flush(pipeline_t *pl);
+
+#endif
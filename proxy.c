@@ -0,0 +1,611 @@
+/*
+ * proxy.c - Source for reverse proxy routes with pooled upstreams.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "abuffer.h"
+#include "network.h"
+#include "shttpd.h"
+#include "proxy.h"
+#include "scoreboard.h"
+
+/* Size of upstream read buffer, also the longest header line */
+#define PROXY_BUFSIZE 8192
+
+/* Length of route prefixes and upstream names */
+#define PROXY_NAMELEN 256
+
+/* Failures while forwarding, only upstream ones count against it */
+#define PROXY_UPSTREAM_ERROR -1
+#define PROXY_CLIENT_ERROR -2
+
+/* Upstream server with a pool of idle keep-alive connections. */
+typedef struct proxy_upstream {
+	char name[PROXY_NAMELEN];
+	struct sockaddr_in addr;
+	pthread_mutex_t lock;
+	SOCKET idle[PROXY_POOL_SIZE];
+	int nidle;
+	int failures;
+	time_t down_until;
+	unsigned long requests;
+	unsigned long reused;
+	unsigned long connects;
+	unsigned long errors;
+} proxy_upstream_t;
+
+/* Route mapping a path prefix to an upstream. */
+struct proxy_route {
+	char prefix[PROXY_NAMELEN];
+	size_t length;
+	proxy_upstream_t *up;
+};
+
+/* Buffered reader for upstream responses. */
+typedef struct proxy_reader {
+	SOCKET fd;
+	char buf[PROXY_BUFSIZE];
+	size_t pos;
+	size_t len;
+} proxy_reader_t;
+
+static proxy_upstream_t upstreams[PROXY_MAX_ROUTES];
+static int nupstreams;
+static proxy_route_t routes[PROXY_MAX_ROUTES];
+static int nroutes;
+static int upstream_timeout = PROXY_TIMEOUT * 1000;
+
+/* ---------------------------- Upstream Stuff --------------------------- */
+
+/* Find or create the upstream for host and port.
+ */
+static proxy_upstream_t *proxy_upstream_get(const char *host, const char *port)
+{
+	struct addrinfo hints, *res;
+	proxy_upstream_t *up;
+	char name[PROXY_NAMELEN];
+	int i;
+
+	snprintf(name, sizeof(name), "%s:%s", host, port);
+	for(i = 0; i < nupstreams; i++)
+		if(strcmp(upstreams[i].name, name) == 0)
+			return &upstreams[i];
+
+	if(nupstreams >= PROXY_MAX_ROUTES)
+		return NULL;
+
+	/* Resolve once at startup, gethostbyname is not thread safe */
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if(getaddrinfo(host, port, &hints, &res) || res == NULL)
+		return NULL;
+
+	up = &upstreams[nupstreams++];
+	memset(up, 0, sizeof(proxy_upstream_t));
+	strncpy(up->name, name, sizeof(up->name)-1);
+	memcpy(&up->addr, res->ai_addr, sizeof(struct sockaddr_in));
+	pthread_mutex_init(&up->lock, NULL);
+	freeaddrinfo(res);
+	return up;
+}
+/* Check if upstream may be used, a down upstream gets retried after
+ * PROXY_RETRY_SECS.
+ */
+static bool proxy_upstream_ok(proxy_upstream_t *up)
+{
+	bool ok;
+
+	pthread_mutex_lock(&up->lock);
+	ok = up->down_until <= time(NULL);
+	up->requests++;
+	if(!ok)
+		up->errors++;
+	pthread_mutex_unlock(&up->lock);
+	return ok;
+}
+/* Record the outcome of talking to an upstream.
+ */
+static void proxy_upstream_result(proxy_upstream_t *up, bool ok)
+{
+	pthread_mutex_lock(&up->lock);
+	if(ok) {
+		up->failures = 0;
+		up->down_until = 0;
+	}
+	else {
+		up->errors++;
+		if(++up->failures >= PROXY_MAX_FAILS) {
+			up->down_until = time(NULL) + PROXY_RETRY_SECS;
+			while(up->nidle > 0)
+				close(up->idle[--up->nidle]);
+		}
+	}
+	pthread_mutex_unlock(&up->lock);
+}
+/* Get a connection to upstream, reusing an idle one unless fresh is set.
+ */
+static SOCKET proxy_pool_get(proxy_upstream_t *up, bool fresh, bool *reused)
+{
+	SOCKET fd = INVALID_SOCKET;
+	char c;
+
+	pthread_mutex_lock(&up->lock);
+	while(!fresh && up->nidle > 0) {
+		fd = up->idle[--up->nidle];
+
+		/* Idle connection with something to read was closed by upstream */
+		if(recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0 &&
+				(errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		close(fd);
+		fd = INVALID_SOCKET;
+	}
+	if(fd != INVALID_SOCKET)
+		up->reused++;
+	else
+		up->connects++;
+	pthread_mutex_unlock(&up->lock);
+
+	*reused = fd != INVALID_SOCKET;
+	if(fd == INVALID_SOCKET)
+		fd = socket_connect_addr(&up->addr);
+	return fd;
+}
+/* Return a connection to the idle pool.
+ */
+static void proxy_pool_put(proxy_upstream_t *up, SOCKET fd)
+{
+	pthread_mutex_lock(&up->lock);
+	if(up->nidle < PROXY_POOL_SIZE && up->down_until == 0) {
+		up->idle[up->nidle++] = fd;
+		fd = INVALID_SOCKET;
+	}
+	pthread_mutex_unlock(&up->lock);
+	if(fd != INVALID_SOCKET)
+		close(fd);
+}
+
+/* ----------------------------- Reader Stuff ---------------------------- */
+
+/* Make sure reader has data, returns bytes available or <= 0 at end.
+ */
+static long proxy_reader_fill(proxy_reader_t *rd)
+{
+	long nbytes;
+
+	if(rd->pos < rd->len)
+		return rd->len - rd->pos;
+
+	/* Slow upstreams get longer than clients do */
+	nbytes = socket_recv_timeout(rd->fd, rd->buf, sizeof(rd->buf),
+		upstream_timeout);
+	rd->pos = 0;
+	rd->len = nbytes > 0 ? nbytes : 0;
+	return nbytes;
+}
+/* Read a line without the line ending, returns -1 on end of stream.
+ */
+static int proxy_reader_line(proxy_reader_t *rd, char *line, size_t size)
+{
+	size_t i = 0;
+	char c;
+
+	for(;;) {
+		if(proxy_reader_fill(rd) <= 0)
+			return -1;
+		c = rd->buf[rd->pos++];
+		if(c == '\n')
+			break;
+		if(i < size-1)
+			line[i++] = c;
+	}
+	if(i > 0 && line[i-1] == '\r')
+		i--;
+	line[i] = '\0';
+	return i;
+}
+/* Copy count bytes to client, or until end of stream if count is -1.
+ */
+static int proxy_reader_copy(proxy_reader_t *rd, SOCKET out, long long count)
+{
+	long nbytes;
+
+	while(count != 0) {
+		nbytes = proxy_reader_fill(rd);
+		if(nbytes <= 0)
+			return (count < 0 && nbytes == 0) ? 0 : -1;
+		if(count > 0 && nbytes > count)
+			nbytes = count;
+		if(socket_send_all(out, rd->buf + rd->pos, nbytes) != nbytes)
+			return -1;
+		scoreboard_sent(nbytes);
+		rd->pos += nbytes;
+		if(count > 0)
+			count -= nbytes;
+	}
+	return 0;
+}
+/* Copy a chunked body to client without the chunk framing.
+ */
+static int proxy_reader_chunked(proxy_reader_t *rd, SOCKET out)
+{
+	char line[PROXY_BUFSIZE];
+	long long size;
+
+	for(;;) {
+		if(proxy_reader_line(rd, line, sizeof(line)) < 0)
+			return -1;
+		size = strtoll(line, NULL, 16);
+		if(size < 0)
+			return -1;
+		if(size == 0)
+			break;
+		if(proxy_reader_copy(rd, out, size) ||
+				proxy_reader_line(rd, line, sizeof(line)) != 0)
+			return -1;
+	}
+
+	/* Skip trailers */
+	while(proxy_reader_line(rd, line, sizeof(line)) > 0);
+	return 0;
+}
+
+/* ----------------------------- Request Stuff --------------------------- */
+
+/* Check if header line has the given name.
+ */
+static bool proxy_header_is(const char *line, const char *name)
+{
+	size_t len = strlen(name);
+
+	return strncasecmp(line, name, len) == 0 && line[len] == ':';
+}
+/* Get the value of a header line.
+ */
+static const char *proxy_header_value(const char *line)
+{
+	const char *value = strchr(line, ':');
+
+	if(value == NULL)
+		return "";
+	value++;
+	while(*value == ' ' || *value == '\t')
+		value++;
+	return value;
+}
+/* Check if header is hop-by-hop and must not be forwarded.
+ */
+static bool proxy_header_hop(const char *line)
+{
+	return proxy_header_is(line, "Connection") ||
+		proxy_header_is(line, "Keep-Alive") ||
+		proxy_header_is(line, "Proxy-Connection") ||
+		proxy_header_is(line, "Transfer-Encoding") ||
+		proxy_header_is(line, "TE") ||
+		proxy_header_is(line, "Upgrade");
+}
+/* Build the upstream request from the client request, returns number of
+ * request body bytes still to be read from the client or -1 on error.
+ */
+static long long proxy_build_request(SOCKET fd, proxy_upstream_t *up,
+	const char *request, int length, AppendBuffer *ab, bool *head)
+{
+	char method[16], target[1024], line[PROXY_BUFSIZE], addr[INET6_ADDRSTRLEN];
+	const char *p, *end, *eol;
+	long long body = 0;
+	bool host = false;
+	size_t len;
+
+	end = memmem(request, length, "\r\n\r\n", 4);
+	if(end == NULL || sscanf(request, "%15s %1023s", method, target) != 2)
+		return -1;
+	*head = strcmp(method, "HEAD") == 0;
+
+	snprintf(line, sizeof(line), "%s %s HTTP/1.1\r\n", method, target);
+	ab_append(ab, line, strlen(line));
+
+	/* Copy end-to-end headers */
+	p = strstr(request, "\r\n") + 2;
+	while(p < end + 2) {
+		eol = strstr(p, "\r\n");
+		len = eol - p;
+		if(len >= sizeof(line))
+			return -1;
+		memcpy(line, p, len);
+		line[len] = '\0';
+		p = eol + 2;
+
+		if(proxy_header_is(line, "Transfer-Encoding"))
+			return -1;
+		if(proxy_header_is(line, "Content-Length"))
+			body = strtoll(proxy_header_value(line), NULL, 10);
+		if(proxy_header_is(line, "Host"))
+			host = true;
+		if(proxy_header_hop(line))
+			continue;
+		ab_append(ab, p - len - 2, len + 2);
+	}
+
+	if(!host) {
+		snprintf(line, sizeof(line), "Host: %s\r\n", up->name);
+		ab_append(ab, line, strlen(line));
+	}
+	if(get_addr(fd, addr, sizeof(addr)) == 0) {
+		snprintf(line, sizeof(line), "X-Forwarded-For: %s\r\n", addr);
+		ab_append(ab, line, strlen(line));
+	}
+	ab_append(ab, "Connection: keep-alive\r\n\r\n", 26);
+
+	/* Body bytes that arrived with the headers */
+	p = end + 4;
+	len = (request + length) - p;
+	if(body < 0)
+		return -1;
+	if((long long)len > body)
+		len = body;
+	ab_append(ab, p, len);
+	return body - len;
+}
+/* Forward remaining request body from client to upstream, returns which
+ * side failed.
+ */
+static int proxy_send_body(SOCKET fd, SOCKET upfd, long long count)
+{
+	char buffer[PROXY_BUFSIZE];
+	long nbytes;
+
+	while(count > 0) {
+		nbytes = socket_recv(fd, buffer,
+			count < (long long)sizeof(buffer) ? count : (long long)sizeof(buffer));
+		if(nbytes <= 0)
+			return PROXY_CLIENT_ERROR;
+		if(socket_send_all(upfd, buffer, nbytes) != nbytes)
+			return PROXY_UPSTREAM_ERROR;
+		count -= nbytes;
+	}
+	return 0;
+}
+/* Read response headers from upstream and send them on to the client,
+ * returns the response status or which side failed.
+ */
+static int proxy_relay_headers(proxy_reader_t *rd, SOCKET fd,
+	long long *length, bool *chunked, bool *keep)
+{
+	char line[PROXY_BUFSIZE];
+	AppendBuffer *ab;
+	int status, minor;
+	const char *value;
+
+	if(proxy_reader_line(rd, line, sizeof(line)) < 0)
+		return PROXY_UPSTREAM_ERROR;
+	if(sscanf(line, "HTTP/1.%d %d", &minor, &status) != 2)
+		return PROXY_UPSTREAM_ERROR;
+
+	*length = -1;
+	*chunked = false;
+	*keep = minor >= 1;
+
+	ab = ab_init();
+	ab_append(ab, line, strlen(line));
+	ab_append(ab, "\r\n", 2);
+	for(;;) {
+		if(proxy_reader_line(rd, line, sizeof(line)) < 0) {
+			ab_free(ab);
+			return PROXY_UPSTREAM_ERROR;
+		}
+		if(line[0] == '\0')
+			break;
+
+		value = proxy_header_value(line);
+		if(proxy_header_is(line, "Content-Length"))
+			*length = strtoll(value, NULL, 10);
+		else if(proxy_header_is(line, "Transfer-Encoding"))
+			*chunked = strcasestr(value, "chunked") != NULL;
+		else if(proxy_header_is(line, "Connection"))
+			*keep = strcasestr(value, "close") == NULL &&
+				(minor >= 1 || strcasestr(value, "keep-alive") != NULL);
+		if(proxy_header_hop(line))
+			continue;
+		ab_append(ab, line, strlen(line));
+		ab_append(ab, "\r\n", 2);
+	}
+	ab_append(ab, "Connection: close\r\n\r\n", 21);
+
+	if(socket_send_all(fd, ab_getdata(ab), ab_getsize(ab)) !=
+			(long)ab_getsize(ab)) {
+		ab_free(ab);
+		return PROXY_CLIENT_ERROR;
+	}
+	scoreboard_sent(ab_getsize(ab));
+	ab_free(ab);
+	return status;
+}
+
+/* ----------------------------- Public Functions ------------------------ */
+
+/* Add a proxy route of the form "/prefix/=host:port".
+ */
+proxy_route_t *proxy_add_route(const char *spec)
+{
+	char buf[PROXY_NAMELEN * 2], *eq, *colon;
+	proxy_route_t *route;
+	proxy_upstream_t *up;
+
+	if(spec == NULL || nroutes >= PROXY_MAX_ROUTES)
+		return NULL;
+
+	strncpy(buf, spec, sizeof(buf)-1);
+	buf[sizeof(buf)-1] = '\0';
+	eq = strchr(buf, '=');
+	if(eq == NULL || buf[0] != '/' || eq - buf >= PROXY_NAMELEN)
+		return NULL;
+	*eq++ = '\0';
+	colon = strrchr(eq, ':');
+	if(colon == NULL || colon == eq)
+		return NULL;
+	*colon++ = '\0';
+
+	up = proxy_upstream_get(eq, colon);
+	if(up == NULL)
+		return NULL;
+
+	route = &routes[nroutes++];
+	strncpy(route->prefix, buf, sizeof(route->prefix)-1);
+	route->length = strlen(route->prefix);
+	route->up = up;
+	return route;
+}
+/* Set the upstream read timeout.
+ */
+void proxy_set_timeout(int seconds)
+{
+	upstream_timeout = seconds * 1000;
+}
+/* Get the path prefix of a proxy route.
+ */
+const char *proxy_route_prefix(proxy_route_t *route)
+{
+	return route->prefix;
+}
+/* Forward a request to the route upstream and stream the response back.
+ */
+int proxy_forward(proxy_route_t *route, SOCKET fd, const char *request,
+	int length)
+{
+	proxy_upstream_t *up = route->up;
+	long long remain, body;
+	proxy_reader_t *rd;
+	AppendBuffer *ab;
+	bool head, reused, chunked, keep, timeout;
+	int attempt, error = 0, status = -1;
+	long nbytes;
+
+	if(!proxy_upstream_ok(up))
+		return RESPONSE_UNAVAILABLE;
+
+	ab = ab_init();
+	remain = proxy_build_request(fd, up, request, length, ab, &head);
+	if(remain < 0) {
+		ab_free(ab);
+		return RESPONSE_BADREQ;
+	}
+
+	rd = malloc(sizeof(proxy_reader_t));
+	if(rd == NULL) {
+		ab_free(ab);
+		return RESPONSE_UNAVAILABLE;
+	}
+
+	/* A pooled connection may have gone stale, retry once on a new one.
+	 * An upstream that is only slow already had the whole timeout.
+	 */
+	for(attempt = 0; attempt < 2; attempt++) {
+		rd->fd = proxy_pool_get(up, attempt > 0, &reused);
+		rd->pos = rd->len = 0;
+		if(rd->fd == INVALID_SOCKET)
+			break;
+
+		nbytes = 0;
+		error = PROXY_UPSTREAM_ERROR;
+		if(socket_send_all(rd->fd, ab_getdata(ab), ab_getsize(ab)) ==
+				(long)ab_getsize(ab))
+			error = proxy_send_body(fd, rd->fd, remain);
+		if(error == 0 && (nbytes = proxy_reader_fill(rd)) > 0)
+			break;
+		timeout = nbytes < 0 && errno == ETIMEDOUT;
+
+		close(rd->fd);
+		rd->fd = INVALID_SOCKET;
+		if(error == PROXY_CLIENT_ERROR || !reused || remain > 0 || timeout)
+			break;
+	}
+	ab_free(ab);
+
+	/* The client is gone, there is nobody to answer */
+	if(error == PROXY_CLIENT_ERROR) {
+		free(rd);
+		return 0;
+	}
+	if(rd->fd == INVALID_SOCKET) {
+		free(rd);
+		proxy_upstream_result(up, false);
+		return RESPONSE_BADGATEWAY;
+	}
+
+	status = proxy_relay_headers(rd, fd, &body, &chunked, &keep);
+	if(status < 0) {
+		close(rd->fd);
+		free(rd);
+		proxy_upstream_result(up, status == PROXY_CLIENT_ERROR);
+		return status == PROXY_CLIENT_ERROR ? 0 : RESPONSE_BADGATEWAY;
+	}
+	proxy_upstream_result(up, true);
+
+	/* Stream the body, its framing decides if the connection is reusable */
+	if(head || status / 100 == 1 || status == 204 || status == 304) {
+		body = 0;
+	}
+	else if(chunked) {
+		keep = keep && proxy_reader_chunked(rd, fd) == 0;
+		body = 0;
+	}
+	else if(body < 0) {
+		keep = false;
+	}
+
+	if(proxy_reader_copy(rd, fd, body) || rd->pos != rd->len)
+		keep = false;
+
+	if(keep)
+		proxy_pool_put(up, rd->fd);
+	else
+		close(rd->fd);
+	free(rd);
+	return 0;
+}
+/* Append upstream statistics to an append buffer.
+ */
+void proxy_stats(AppendBuffer *ab)
+{
+	char line[512];
+	int i;
+
+	for(i = 0; i < nupstreams; i++) {
+		proxy_upstream_t *up = &upstreams[i];
+
+		pthread_mutex_lock(&up->lock);
+		snprintf(line, sizeof(line),
+			"upstream %s: %s idle=%d requests=%lu reused=%lu connects=%lu "
+			"errors=%lu\n", up->name, up->down_until > time(NULL) ? "down" : "up",
+			up->nidle, up->requests, up->reused, up->connects, up->errors);
+		pthread_mutex_unlock(&up->lock);
+		ab_append(ab, line, strlen(line));
+	}
+}
+/* Close pooled connections and free upstreams.
+ */
+void proxy_cleanup(void)
+{
+	int i;
+
+	for(i = 0; i < nupstreams; i++) {
+		while(upstreams[i].nidle > 0)
+			close(upstreams[i].idle[--upstreams[i].nidle]);
+		pthread_mutex_destroy(&upstreams[i].lock);
+	}
+	nupstreams = 0;
+	nroutes = 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * proxy.h - Header for reverse proxy routes with pooled upstreams.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ */
+
+#ifndef PROXY_H
+#define PROXY_H
+
+#include "abuffer.h"
+#include "network.h"
+
+/* Most proxy routes that can be registered */
+#define PROXY_MAX_ROUTES 16
+
+/* Most idle keep-alive connections kept per upstream */
+#define PROXY_POOL_SIZE 8
+
+/* Consecutive failures before an upstream is marked down */
+#define PROXY_MAX_FAILS 3
+
+/* Seconds an upstream stays down before it is tried again */
+#define PROXY_RETRY_SECS 5
+
+/* Default seconds to wait for an upstream to send more of a response */
+#define PROXY_TIMEOUT 60
+
+/* Forward declaration of struct and define typedef. */
+struct proxy_route;
+typedef struct proxy_route proxy_route_t;
+
+/* Add a proxy route of the form "/prefix/=host:port". */
+proxy_route_t *proxy_add_route(const char *spec);
+
+/* Set the seconds to wait for an upstream to send more of a response. */
+void proxy_set_timeout(int seconds);
+
+/* Get the path prefix of a proxy route. */
+const char *proxy_route_prefix(proxy_route_t *route);
+
+/* Forward a request, returns 0 once a response was sent or the client is
+ * gone, otherwise a response code for the caller to send. */
+int proxy_forward(proxy_route_t *route, SOCKET fd, const char *request,
+	int length);
+
+/* Append upstream statistics to an append buffer. */
+void proxy_stats(AppendBuffer *ab);
+
+/* Close pooled connections and free upstreams. */
+void proxy_cleanup(void);
+
+#endif
@@ -0,0 +1,396 @@
+/*
+ * proxy_check.c - Checks reverse proxy routes against a stub backend.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ *
+ * Runs a stub upstream in this process and the server as a child with
+ * proxy routes pointing at it. Every check sends one request through the
+ * server and looks at the response and at what the stub saw, so pooling
+ * and retries show up as the number of upstream connections.
+ *
+ ****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "network.h"
+#include "proxy.h"
+
+/* Upstream reads time out after this many seconds in the server */
+#define CHECK_TIMEOUT 1
+
+/* Size of request and response buffers */
+#define CHECK_BUFSIZE 16384
+
+/* Response from the server. */
+typedef struct check_response {
+	int status;
+	char head[CHECK_BUFSIZE];
+	const char *body;
+	size_t length;
+	double secs;
+} check_response_t;
+
+static SOCKET stub_server;
+static unsigned short server_port;
+static _Atomic int stub_connects;
+static _Atomic bool stub_drop_next;
+static int failures;
+
+/* ----------------------------- Stub Backend ---------------------------- */
+
+/* Read one request head, returns its length or -1 at end of stream.
+ */
+static int stub_read(SOCKET fd, char *buf, size_t size)
+{
+	size_t len = 0;
+	long nbytes;
+
+	while(len < size - 1) {
+		nbytes = recv(fd, buf + len, size - 1 - len, 0);
+		if(nbytes <= 0)
+			return -1;
+		len += nbytes;
+		buf[len] = '\0';
+		if(strstr(buf, "\r\n\r\n") != NULL)
+			return (int)len;
+	}
+	return -1;
+}
+/* Send a response with a body framed by Content-Length.
+ */
+static void stub_reply(SOCKET fd, const char *status, const char *body,
+	bool head)
+{
+	char buf[CHECK_BUFSIZE];
+
+	snprintf(buf, sizeof(buf), "HTTP/1.1 %s\r\nContent-Length: %zu\r\n\r\n%s",
+		status, strlen(body), head ? "" : body);
+	socket_send_all(fd, buf, strlen(buf));
+}
+/* Answer requests on one upstream connection until it is closed.
+ */
+static void *stub_connection(void *arg)
+{
+	SOCKET fd = (SOCKET)(intptr_t)arg;
+	char buf[CHECK_BUFSIZE], method[16], path[256];
+	struct timespec ts;
+
+	while(stub_read(fd, buf, sizeof(buf)) > 0) {
+		if(sscanf(buf, "%15s %255s", method, path) != 2)
+			break;
+
+		/* Close instead of answering, like an upstream timing out the
+		 * idle connection just as it is reused
+		 */
+		if(atomic_exchange(&stub_drop_next, false))
+			break;
+
+		if(strstr(path, "/chunked") != NULL) {
+			snprintf(buf, sizeof(buf), "HTTP/1.1 200 OK\r\n"
+				"Transfer-Encoding: chunked\r\n\r\n"
+				"6\r\nhello \r\n5\r\nworld\r\n0\r\n\r\n");
+			socket_send_all(fd, buf, strlen(buf));
+		}
+		else if(strstr(path, "/nocontent") != NULL) {
+			snprintf(buf, sizeof(buf), "HTTP/1.1 204 No Content\r\n\r\n");
+			socket_send_all(fd, buf, strlen(buf));
+		}
+		else if(strstr(path, "/notmodified") != NULL) {
+			/* Describes the representation, there is no body */
+			snprintf(buf, sizeof(buf), "HTTP/1.1 304 Not Modified\r\n"
+				"Content-Length: 5\r\n\r\n");
+			socket_send_all(fd, buf, strlen(buf));
+		}
+		else if(strstr(path, "/slow") != NULL) {
+			ts.tv_sec = CHECK_TIMEOUT + 1;
+			ts.tv_nsec = 0;
+			nanosleep(&ts, NULL);
+			stub_reply(fd, "200 OK", "late", false);
+		}
+		else if(strstr(path, "/stale") != NULL) {
+			stub_reply(fd, "200 OK", "armed", false);
+			atomic_store(&stub_drop_next, true);
+		}
+		else {
+			stub_reply(fd, "200 OK", "plain", strcmp(method, "HEAD") == 0);
+		}
+	}
+	close(fd);
+	return NULL;
+}
+/* Accept upstream connections, one thread each.
+ */
+static void *stub_accept(void *arg)
+{
+	pthread_t thread;
+	SOCKET fd;
+
+	(void)arg;
+	for(;;) {
+		fd = accept(stub_server, NULL, NULL);
+		if(fd == INVALID_SOCKET)
+			break;
+		stub_connects++;
+		if(pthread_create(&thread, NULL, stub_connection,
+				(void *)(intptr_t)fd)) {
+			close(fd);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+	return NULL;
+}
+
+/* ----------------------------- Check Stuff ----------------------------- */
+
+/* Get monotonic time in seconds.
+ */
+static double check_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+/* Get a port nothing listens on.
+ */
+static unsigned short check_free_port(void)
+{
+	unsigned short port = 0;
+	SOCKET fd;
+
+	fd = server_socket_open_backlog(&port, 1);
+	if(fd == INVALID_SOCKET)
+		return 0;
+	close(fd);
+	return port;
+}
+/* Connect to the server.
+ */
+static SOCKET check_connect(void)
+{
+	struct sockaddr_in addr;
+	SOCKET fd;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(fd == INVALID_SOCKET)
+		return INVALID_SOCKET;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(server_port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(fd);
+		return INVALID_SOCKET;
+	}
+	return fd;
+}
+/* Send a request through the server and read the whole response.
+ */
+static int check_fetch(const char *method, const char *path,
+	check_response_t *res)
+{
+	static char buf[CHECK_BUFSIZE * 2];
+	char request[512];
+	size_t len = 0;
+	long nbytes;
+	char *end;
+	SOCKET fd;
+
+	memset(res, 0, sizeof(check_response_t));
+	res->secs = check_now();
+	fd = check_connect();
+	if(fd == INVALID_SOCKET)
+		return -1;
+	snprintf(request, sizeof(request), "%s %s HTTP/1.1\r\nHost: check\r\n"
+		"Connection: close\r\n\r\n", method, path);
+	if(socket_send_all(fd, request, strlen(request)) != (long)strlen(request)) {
+		close(fd);
+		return -1;
+	}
+
+	/* Proxied responses always end with the connection */
+	while(len < sizeof(buf) - 1 && socket_wait(fd, POLLIN,
+			(CHECK_TIMEOUT + 4) * 1000) > 0) {
+		nbytes = recv(fd, buf + len, sizeof(buf) - 1 - len, 0);
+		if(nbytes <= 0)
+			break;
+		len += nbytes;
+	}
+	close(fd);
+	buf[len] = '\0';
+	res->secs = check_now() - res->secs;
+
+	end = strstr(buf, "\r\n\r\n");
+	if(end == NULL || sscanf(buf, "HTTP/1.%*d %d", &res->status) != 1)
+		return -1;
+	snprintf(res->head, sizeof(res->head), "%.*s", (int)(end - buf), buf);
+	res->body = end + 4;
+	res->length = len - (end + 4 - buf);
+	return 0;
+}
+/* Send a request head promising a body and hang up before sending it.
+ */
+static void check_abandon(const char *path)
+{
+	char request[512];
+	SOCKET fd;
+
+	fd = check_connect();
+	if(fd == INVALID_SOCKET)
+		return;
+	snprintf(request, sizeof(request), "POST %s HTTP/1.1\r\nHost: check\r\n"
+		"Content-Length: 100\r\n\r\npartial", path);
+	socket_send_all(fd, request, strlen(request));
+	close(fd);
+}
+/* Report the outcome of one check.
+ */
+static void check_result(const char *name, bool ok, const check_response_t *res)
+{
+	if(ok) {
+		printf("ok   %s\n", name);
+		return;
+	}
+	failures++;
+	printf("FAIL %s: status=%d length=%zu time=%.2fs\n", name, res->status,
+		res->length, res->secs);
+}
+/* Check a response status and body.
+ */
+static void check_expect(const char *name, const char *method,
+	const char *path, int status, const char *body)
+{
+	check_response_t res;
+	bool ok;
+
+	ok = check_fetch(method, path, &res) == 0 && res.status == status &&
+		res.length == strlen(body) && memcmp(res.body, body, res.length) == 0 &&
+		res.secs < CHECK_TIMEOUT;
+	check_result(name, ok, &res);
+}
+/* Check the number of connections the stub accepted so far.
+ */
+static void check_connects(const char *name, int expected)
+{
+	check_response_t res;
+
+	memset(&res, 0, sizeof(res));
+	res.status = stub_connects;
+	check_result(name, stub_connects == expected, &res);
+}
+/* Run every check against a running server.
+ */
+static void check_run(void)
+{
+	check_response_t res;
+	int i;
+
+	check_expect("content-length body", "GET", "/api/plain", 200, "plain");
+	for(i = 0; i < 4; i++)
+		check_expect("pooled request", "GET", "/api/plain", 200, "plain");
+	check_connects("one upstream connection for five requests", 1);
+
+	check_expect("chunked body is de-chunked", "GET", "/api/chunked", 200,
+		"hello world");
+	check_fetch("GET", "/api/chunked", &res);
+	check_result("no chunked framing towards the client",
+		strstr(res.head, "Transfer-Encoding") == NULL, &res);
+	check_expect("HEAD has no body", "HEAD", "/api/plain", 200, "");
+	check_expect("204 has no body", "GET", "/api/nocontent", 204, "");
+	check_expect("304 has no body", "GET", "/api/notmodified", 304, "");
+	check_connects("bodiless responses keep the connection pooled", 1);
+
+	check_expect("stale connection armed", "GET", "/api/stale", 200,
+		"armed");
+	check_expect("stale pooled connection is retried", "GET", "/api/plain",
+		200, "plain");
+	check_connects("retry opens one new connection", 2);
+
+	check_fetch("GET", "/api/slow", &res);
+	check_result("slow upstream times out with 502", res.status == 502 &&
+		res.secs >= CHECK_TIMEOUT - 0.1 && res.secs < CHECK_TIMEOUT + 1, &res);
+	check_expect("upstream still usable after a timeout", "GET",
+		"/api/plain", 200, "plain");
+
+	for(i = 0; i < PROXY_MAX_FAILS; i++)
+		check_abandon("/api/plain");
+	usleep(200000);
+	check_expect("clients hanging up do not mark upstream down", "GET",
+		"/api/plain", 200, "plain");
+
+	for(i = 0; i < 3; i++)
+		check_expect("unreachable upstream gets 502", "GET", "/down/x", 502,
+			"");
+	check_expect("upstream marked down gets 503", "GET", "/down/x", 503, "");
+}
+
+/* ----------------------------- Main Function --------------------------- */
+
+int main(int argc, char *argv[])
+{
+	char api[64], down[64], port[16], timeout[16];
+	unsigned short stub_port = 0, down_port;
+	check_response_t res;
+	pthread_t thread;
+	pid_t pid;
+	int i;
+
+	if(argc != 2) {
+		fprintf(stderr, "Usage: %s path/to/shttpd\n", argv[0]);
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	stub_server = server_socket_open_backlog(&stub_port, 16);
+	down_port = check_free_port();
+	server_port = check_free_port();
+	if(stub_server == INVALID_SOCKET || down_port == 0 || server_port == 0 ||
+			pthread_create(&thread, NULL, stub_accept, NULL)) {
+		fprintf(stderr, "Error: Cannot start stub backend.\n");
+		return 1;
+	}
+
+	snprintf(api, sizeof(api), "/api/=127.0.0.1:%hu", stub_port);
+	snprintf(down, sizeof(down), "/down/=127.0.0.1:%hu", down_port);
+	snprintf(port, sizeof(port), "%hu", server_port);
+	snprintf(timeout, sizeof(timeout), "%d", CHECK_TIMEOUT);
+	pid = fork();
+	if(pid == 0) {
+		execl(argv[1], argv[1], "-p", api, "-p", down, "-T", timeout, port,
+			(char *)NULL);
+		_exit(127);
+	}
+	if(pid < 0) {
+		fprintf(stderr, "Error: Cannot run '%s'.\n", argv[1]);
+		return 1;
+	}
+
+	/* Wait for the server to listen */
+	for(i = 0; i < 50 && check_fetch("GET", "/server-status", &res); i++)
+		usleep(100000);
+	if(i == 50) {
+		fprintf(stderr, "Error: Server did not start.\n");
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		return 1;
+	}
+
+	check_run();
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	printf("%d check(s) failed\n", failures);
+	return failures > 0;
+}
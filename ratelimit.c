@@ -0,0 +1,298 @@
+/*
+ * ratelimit.c - Source for per-client token bucket rate limiting.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ *
+ * Buckets live in a fixed-size open-addressed table. Each slot is a hashed
+ * client key and a packed state word of the last refill time in ms (high
+ * 32 bits) and tokens in thousandths (low 32 bits), both updated with
+ * compare-and-swap so checks never take a lock.
+ *
+ ****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include <netinet/in.h>
+
+#include "ratelimit.h"
+
+/* Bucket kinds, mixed into the key so they never collide */
+enum {
+	RATELIMIT_ADDR = 1,
+	RATELIMIT_PREFIX = 2
+};
+
+/* Slot in the client table. */
+typedef struct ratelimit_slot {
+	_Atomic uint64_t key;
+	_Atomic uint64_t state;
+} ratelimit_slot_t;
+
+/* Token bucket settings in thousandths of a token. */
+typedef struct ratelimit_bucket {
+	uint32_t rate;
+	uint32_t burst;
+} ratelimit_bucket_t;
+
+/* Main structure for the rate limiter. */
+struct ratelimit {
+	ratelimit_slot_t slots[RATELIMIT_SLOTS];
+	ratelimit_bucket_t addr;
+	ratelimit_bucket_t prefix;
+	struct timespec epoch;
+	_Atomic unsigned long long allowed;
+	_Atomic unsigned long long limited;
+	_Atomic unsigned long long evicted;
+};
+
+/* ---------------------------- Private Functions ------------------------ */
+
+/* Get milliseconds since the rate limiter was created, wraps at 2^32.
+ */
+static uint32_t ratelimit_now(ratelimit_t *rl)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((ts.tv_sec - rl->epoch.tv_sec) * 1000 +
+		(ts.tv_nsec - rl->epoch.tv_nsec) / 1000000);
+}
+/* Mix bits of a key, never returns zero since that marks an empty slot.
+ */
+static uint64_t ratelimit_hash(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x ? x : 1;
+}
+/* Make the table key for a client address and bucket kind.
+ */
+static uint64_t ratelimit_key(const struct sockaddr *sa, int kind)
+{
+	uint64_t hi, lo;
+
+	if(sa->sa_family == AF_INET) {
+		uint32_t ip = ntohl(((const struct sockaddr_in *)sa)->sin_addr.s_addr);
+
+		if(kind == RATELIMIT_PREFIX)
+			ip &= 0xffffff00;
+		return ratelimit_hash(((uint64_t)kind << 56) | (4ULL << 48) | ip);
+	}
+	if(sa->sa_family == AF_INET6) {
+		const unsigned char *a =
+			((const struct sockaddr_in6 *)sa)->sin6_addr.s6_addr;
+
+		memcpy(&hi, a, 8);
+		memcpy(&lo, a + 8, 8);
+		if(kind == RATELIMIT_PREFIX)
+			lo = 0;
+		return ratelimit_hash(ratelimit_hash(hi ^ ((uint64_t)kind << 56)) ^ lo);
+	}
+	return 0;
+}
+/* Pack time and tokens into a state word.
+ */
+static uint64_t ratelimit_pack(uint32_t now, uint32_t tokens)
+{
+	return ((uint64_t)now << 32) | tokens;
+}
+/* Find the slot for key, claiming an empty or the least recently used
+ * slot in the probe window when insert is set.
+ */
+static ratelimit_slot_t *ratelimit_slot(ratelimit_t *rl, uint64_t key,
+	uint32_t now, uint32_t full, bool insert)
+{
+	ratelimit_slot_t *slot, *oldest = NULL;
+	uint64_t k, expect;
+	uint32_t age, oldest_age = 0;
+	size_t i;
+
+	for(i = 0; i < RATELIMIT_PROBE; i++) {
+		slot = &rl->slots[(key + i) & (RATELIMIT_SLOTS - 1)];
+		k = atomic_load_explicit(&slot->key, memory_order_acquire);
+		if(k == key)
+			return slot;
+		if(!insert)
+			continue;
+
+		if(k == 0) {
+			expect = 0;
+			if(atomic_compare_exchange_strong(&slot->key, &expect, key)) {
+				atomic_store(&slot->state, ratelimit_pack(now, full));
+				return slot;
+			}
+			if(expect == key)
+				return slot;
+			continue;
+		}
+
+		age = now - (uint32_t)(atomic_load_explicit(&slot->state,
+			memory_order_relaxed) >> 32);
+		if(oldest == NULL || age > oldest_age) {
+			oldest = slot;
+			oldest_age = age;
+		}
+	}
+	if(oldest == NULL)
+		return NULL;
+
+	/* Evict, losing a race here just means sharing a bucket for a moment */
+	expect = atomic_load(&oldest->key);
+	if(atomic_compare_exchange_strong(&oldest->key, &expect, key)) {
+		atomic_store(&oldest->state, ratelimit_pack(now, full));
+		atomic_fetch_add_explicit(&rl->evicted, 1, memory_order_relaxed);
+	}
+	return oldest;
+}
+/* Check a single bucket, taking a token when consume is set.
+ */
+static bool ratelimit_take(ratelimit_t *rl, ratelimit_bucket_t *b,
+	uint64_t key, uint32_t now, bool consume)
+{
+	ratelimit_slot_t *slot;
+	uint64_t old, tokens;
+	uint32_t elapsed;
+
+	if(b->rate == 0 || key == 0)
+		return true;
+
+	slot = ratelimit_slot(rl, key, now, b->burst, consume);
+	if(slot == NULL)
+		return true;
+
+	old = atomic_load(&slot->state);
+	do {
+		elapsed = now - (uint32_t)(old >> 32);
+		tokens = (old & 0xffffffff) + (uint64_t)elapsed * b->rate / 1000;
+		if(tokens > b->burst)
+			tokens = b->burst;
+		if(tokens < 1000)
+			return false;
+		if(!consume)
+			return true;
+	} while(!atomic_compare_exchange_weak(&slot->state, &old,
+		ratelimit_pack(now, (uint32_t)(tokens - 1000))));
+	return true;
+}
+/* Give back a token taken by ratelimit_take().
+ */
+static void ratelimit_refund(ratelimit_t *rl, ratelimit_bucket_t *b,
+	uint64_t key, uint32_t now)
+{
+	ratelimit_slot_t *slot;
+	uint64_t old, tokens;
+
+	if(b->rate == 0 || key == 0)
+		return;
+
+	slot = ratelimit_slot(rl, key, now, b->burst, false);
+	if(slot == NULL)
+		return;
+
+	old = atomic_load(&slot->state);
+	do {
+		tokens = (old & 0xffffffff) + 1000;
+		if(tokens > b->burst)
+			tokens = b->burst;
+	} while(!atomic_compare_exchange_weak(&slot->state, &old,
+		(old & 0xffffffff00000000ULL) | tokens));
+}
+
+/* ----------------------------- Public Functions ------------------------ */
+
+/* Create a rate limiter.
+ */
+ratelimit_t *ratelimit_create(unsigned int rate, unsigned int burst,
+	unsigned int prefix_rate, unsigned int prefix_burst)
+{
+	ratelimit_t *rl;
+	size_t i;
+
+	if(rate > 1000000 || prefix_rate > 1000000 ||
+			burst > 1000000 || prefix_burst > 1000000)
+		return NULL;
+
+	rl = calloc(1, sizeof(ratelimit_t));
+	if(rl != NULL) {
+		for(i = 0; i < RATELIMIT_SLOTS; i++) {
+			atomic_init(&rl->slots[i].key, 0);
+			atomic_init(&rl->slots[i].state, 0);
+		}
+		rl->addr.rate = rate * 1000;
+		rl->addr.burst = (burst ? burst : rate) * 1000;
+		rl->prefix.rate = prefix_rate * 1000;
+		rl->prefix.burst = (prefix_burst ? prefix_burst : prefix_rate) * 1000;
+		clock_gettime(CLOCK_MONOTONIC, &rl->epoch);
+		atomic_init(&rl->allowed, 0);
+		atomic_init(&rl->limited, 0);
+		atomic_init(&rl->evicted, 0);
+	}
+	return rl;
+}
+/* Destroy the rate limiter.
+ */
+void ratelimit_destroy(ratelimit_t *rl)
+{
+	free(rl);
+}
+/* Check if client may proceed.
+ */
+bool ratelimit_allow(ratelimit_t *rl, const struct sockaddr *sa, bool consume)
+{
+	uint64_t addr, prefix;
+	uint32_t now;
+	bool ok;
+
+	if(rl == NULL || sa == NULL)
+		return true;
+
+	now = ratelimit_now(rl);
+	addr = ratelimit_key(sa, RATELIMIT_ADDR);
+	prefix = ratelimit_key(sa, RATELIMIT_PREFIX);
+
+	/* Both buckets must allow it before either is debited, a token taken
+	 * just before the prefix ran dry in the meantime is given back
+	 */
+	ok = ratelimit_take(rl, &rl->addr, addr, now, false) &&
+		ratelimit_take(rl, &rl->prefix, prefix, now, false);
+	if(ok && consume && ratelimit_take(rl, &rl->addr, addr, now, true)) {
+		ok = ratelimit_take(rl, &rl->prefix, prefix, now, true);
+		if(!ok)
+			ratelimit_refund(rl, &rl->addr, addr, now);
+	}
+	else if(ok && consume) {
+		ok = false;
+	}
+
+	if(ok)
+		atomic_fetch_add_explicit(&rl->allowed, consume, memory_order_relaxed);
+	else
+		atomic_fetch_add_explicit(&rl->limited, 1, memory_order_relaxed);
+	return ok;
+}
+/* Get a statistics snapshot.
+ */
+void ratelimit_get_stats(ratelimit_t *rl, ratelimit_stats_t *st)
+{
+	if(st == NULL)
+		return;
+	memset(st, 0, sizeof(ratelimit_stats_t));
+	if(rl == NULL)
+		return;
+
+	st->allowed = atomic_load(&rl->allowed);
+	st->limited = atomic_load(&rl->limited);
+	st->evicted = atomic_load(&rl->evicted);
+}
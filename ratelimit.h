@@ -0,0 +1,52 @@
+/*
+ * ratelimit.h - Header for per-client token bucket rate limiting.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ */
+
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/socket.h>
+
+/* Number of slots in the client table, must be a power of two */
+#ifndef RATELIMIT_SLOTS
+#define RATELIMIT_SLOTS 4096
+#endif
+
+/* Slots probed before the oldest one in the window is evicted */
+#define RATELIMIT_PROBE 8
+
+/* Forward declaration of struct and define typedef. */
+struct ratelimit;
+typedef struct ratelimit ratelimit_t;
+
+/* Snapshot of rate limiter statistics. */
+typedef struct ratelimit_stats {
+	unsigned long long allowed;
+	unsigned long long limited;
+	unsigned long long evicted;
+} ratelimit_stats_t;
+
+/* Create a rate limiter, a zero rate disables that bucket kind. Rates are
+ * in requests per second for each address and each /24 or /64 prefix. */
+ratelimit_t *ratelimit_create(unsigned int rate, unsigned int burst,
+	unsigned int prefix_rate, unsigned int prefix_burst);
+
+/* Destroy the rate limiter. */
+void ratelimit_destroy(ratelimit_t *rl);
+
+/* Check if client may proceed, a token is only taken when consume is set
+ * and then from both buckets or neither. */
+bool ratelimit_allow(ratelimit_t *rl, const struct sockaddr *sa, bool consume);
+
+/* Get a statistics snapshot. */
+void ratelimit_get_stats(ratelimit_t *rl, ratelimit_stats_t *st);
+
+#endif
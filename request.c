@@ -0,0 +1,296 @@
+/*
+ * request.c - Source for reading request heads into pooled buffers.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ *
+ * Lines are parsed as they arrive and the spans point straight into the
+ * pooled buffers. When a buffer fills up the unfinished line is moved to the
+ * next buffer in the chain, so a line never straddles two buffers and
+ * nothing already parsed is copied. Pipelined requests share the buffer
+ * their bytes arrived in, each holding a reference to it.
+ *
+ ****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "shttpd.h"
+#include "request.h"
+
+/* ---------------------------- Private Functions ------------------------ */
+
+/* Point a span at length bytes from ptr.
+ */
+static void request_span_set(iospan_t *span, iobuf_t *b, const char *ptr,
+	size_t length)
+{
+	span->buf = b;
+	span->ptr = ptr;
+	span->length = length;
+}
+/* Check if a header line has the given name.
+ */
+static bool request_header_is(const char *line, size_t length,
+	const char *name)
+{
+	size_t n = strlen(name);
+
+	return length > n && line[n] == ':' && strncasecmp(line, name, n) == 0;
+}
+/* Parse the request line.
+ */
+static int request_parse_first(request_t *req, iobuf_t *b, const char *line,
+	size_t length)
+{
+	const char *sp, *end = line + length;
+
+	sp = memchr(line, ' ', length);
+	if(sp == NULL || sp == line)
+		return -1;
+	request_span_set(&req->method, b, line, sp - line);
+
+	line = sp + 1;
+	sp = memchr(line, ' ', end - line);
+	if(sp == NULL)
+		sp = end;
+	if(sp == line)
+		return -1;
+	request_span_set(&req->path, b, line, sp - line);
+
+	if(sp < end)
+		request_span_set(&req->version, b, sp + 1, end - sp - 1);
+	return 0;
+}
+/* Parse a header line, only the headers the server looks at are kept.
+ */
+static void request_parse_header(request_t *req, iobuf_t *b, const char *line,
+	size_t length)
+{
+	const char *value, *end = line + length;
+	iospan_t *span;
+
+	if(request_header_is(line, length, "Host"))
+		span = &req->host;
+	else if(request_header_is(line, length, "Accept-Encoding"))
+		span = &req->accept_encoding;
+	else if(request_header_is(line, length, "Connection"))
+		span = &req->connection;
+	else
+		return;
+
+	value = memchr(line, ':', length) + 1;
+	while(value < end && (*value == ' ' || *value == '\t'))
+		value++;
+	while(end > value && (end[-1] == ' ' || end[-1] == '\t'))
+		end--;
+	request_span_set(span, b, value, end - value);
+}
+/* Decide if the connection may stay open after the response.
+ */
+static void request_finish(request_t *req)
+{
+	if(request_span_is(&req->version, "HTTP/1.1"))
+		req->keep = !request_span_has(&req->connection, "close");
+	else
+		req->keep = request_span_has(&req->connection, "keep-alive");
+}
+/* Parse every complete line in the last buffer.
+ */
+static int request_scan(request_t *req, unsigned short *code)
+{
+	iobuf_t *b = req->tail;
+	const char *line, *nl;
+	size_t length;
+
+	while((nl = memchr(b->data + req->scan, '\n',
+			b->length - req->scan)) != NULL) {
+		line = b->data + req->scan;
+		length = nl - line;
+		if(length > 0 && line[length-1] == '\r')
+			length--;
+		req->scan = nl + 1 - b->data;
+
+		if(length == 0) {
+			/* Blank lines before the request line are allowed */
+			if(req->lines == 0)
+				continue;
+			req->end = req->scan;
+			request_finish(req);
+			return 1;
+		}
+		if(req->lines++ == 0) {
+			if(request_parse_first(req, b, line, length)) {
+				*code = RESPONSE_BADREQ;
+				return -1;
+			}
+		}
+		else {
+			request_parse_header(req, b, line, length);
+		}
+	}
+	return 0;
+}
+
+/* ----------------------------- Public Functions ------------------------ */
+
+/* Set up an empty request.
+ */
+void request_init(request_t *req)
+{
+	memset(req, 0, sizeof(request_t));
+}
+/* Read a request head.
+ */
+int request_read(request_t *req, SOCKET fd, unsigned short *code)
+{
+	iobuf_t *b, *next;
+	size_t partial;
+	long nbytes;
+	int rc;
+
+	*code = 0;
+	if(req->tail == NULL) {
+		req->head = req->tail = iobuf_get();
+		if(req->head == NULL) {
+			*code = RESPONSE_UNAVAILABLE;
+			return -1;
+		}
+		req->nbufs = 1;
+	}
+
+	for(;;) {
+		rc = request_scan(req, code);
+		if(rc != 0)
+			return rc;
+
+		/* Carry the unfinished line over to a fresh buffer */
+		b = req->tail;
+		if(b->length == BUFPOOL_BUFSIZE) {
+			partial = b->length - req->scan;
+			if(partial == BUFPOOL_BUFSIZE ||
+					req->nbufs >= REQUEST_MAX_BUFFERS) {
+				*code = RESPONSE_TOOLARGE;
+				return -1;
+			}
+			next = iobuf_get();
+			if(next == NULL) {
+				*code = RESPONSE_UNAVAILABLE;
+				return -1;
+			}
+			memcpy(next->data, b->data + req->scan, partial);
+			next->length = partial;
+			b->length = req->scan;
+			b->next = next;
+			req->tail = next;
+			req->nbufs++;
+			req->scan = 0;
+			continue;
+		}
+
+		nbytes = socket_recv(fd, b->data + b->length,
+			BUFPOOL_BUFSIZE - b->length);
+		if(nbytes <= 0)
+			return (nbytes == 0 && req->nbufs == 1 &&
+				b->length == req->start) ? 0 : -1;
+		b->length += nbytes;
+	}
+}
+/* Parse a request head from the bytes already received.
+ */
+int request_parse(request_t *req, unsigned short *code)
+{
+	*code = 0;
+	return req->tail != NULL ? request_scan(req, code) : 0;
+}
+/* Start the next request in the bytes received after a head.
+ */
+void request_next(request_t *req, request_t *next)
+{
+	request_init(next);
+	iobuf_ref(req->tail);
+	next->head = next->tail = req->tail;
+	next->nbufs = 1;
+	next->start = next->scan = req->end;
+}
+/* Get the number of bytes received after the head.
+ */
+size_t request_extra(const request_t *req)
+{
+	return req->tail != NULL ? req->tail->length - req->end : 0;
+}
+/* Copy the path into a string.
+ */
+bool request_path(const request_t *req, char *path, size_t size)
+{
+	if(req->path.length >= size)
+		return false;
+	memcpy(path, req->path.ptr, req->path.length);
+	path[req->path.length] = '\0';
+	return true;
+}
+/* Get the head and any bytes after it as one block.
+ */
+const char *request_data(const request_t *req, size_t *length, char **copy)
+{
+	iobuf_t *b;
+	size_t n = 0;
+
+	*copy = NULL;
+	if(req->head == req->tail) {
+		*length = req->head->length - req->start;
+		return req->head->data + req->start;
+	}
+
+	for(b = req->head; b != NULL; b = b->next)
+		n += b->length;
+	n -= req->start;
+	*copy = malloc(n);
+	if(*copy == NULL)
+		return NULL;
+	memcpy(*copy, req->head->data + req->start, req->head->length - req->start);
+	n = req->head->length - req->start;
+	for(b = req->head->next; b != NULL; b = b->next) {
+		memcpy(*copy + n, b->data, b->length);
+		n += b->length;
+	}
+	*length = n;
+	return *copy;
+}
+/* Give the request's buffers back to the pool.
+ */
+void request_free(request_t *req)
+{
+	iobuf_t *b, *next;
+
+	/* A later request may have chained more buffers onto the tail */
+	for(b = req->head; b != NULL; b = next) {
+		next = b != req->tail ? b->next : NULL;
+		iobuf_release(b);
+	}
+	request_init(req);
+}
+/* Check if a span holds exactly str.
+ */
+bool request_span_is(const iospan_t *span, const char *str)
+{
+	size_t n = strlen(str);
+
+	return span->length == n && memcmp(span->ptr, str, n) == 0;
+}
+/* Check if a span contains token, ignoring case.
+ */
+bool request_span_has(const iospan_t *span, const char *token)
+{
+	size_t i, n = strlen(token);
+
+	for(i = 0; i + n <= span->length; i++)
+		if(strncasecmp(span->ptr + i, token, n) == 0)
+			return true;
+	return false;
+}
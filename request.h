@@ -0,0 +1,69 @@
+/*
+ * request.h - Header for reading request heads into pooled buffers.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ */
+
+#ifndef REQUEST_H
+#define REQUEST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bufpool.h"
+#include "network.h"
+
+/* Most buffers a request head may take up */
+#define REQUEST_MAX_BUFFERS 8
+
+/* Request head, spans point into the chain of buffers. */
+typedef struct request {
+	iobuf_t *head;
+	iobuf_t *tail;
+	size_t nbufs;
+	size_t start;
+	size_t scan;
+	size_t end;
+	unsigned int lines;
+	iospan_t method;
+	iospan_t path;
+	iospan_t version;
+	iospan_t host;
+	iospan_t accept_encoding;
+	iospan_t connection;
+	bool keep;
+} request_t;
+
+/* Set up an empty request. */
+void request_init(request_t *req);
+/* Read a request head, returns 1 when complete, 0 if the client closed
+ * before sending anything and -1 on error with a response code to send in
+ * code, or 0 for none. */
+int request_read(request_t *req, SOCKET fd, unsigned short *code);
+/* Parse a request head from the bytes already received without reading,
+ * returns 1 when complete, 0 if more bytes are needed and -1 on error
+ * with a response code in code. */
+int request_parse(request_t *req, unsigned short *code);
+/* Start next as the request following req's head, sharing the buffer the
+ * bytes after the head arrived in. */
+void request_next(request_t *req, request_t *next);
+/* Get the number of bytes received after the head. */
+size_t request_extra(const request_t *req);
+/* Copy the path into a string, returns false if it doesn't fit. */
+bool request_path(const request_t *req, char *path, size_t size);
+/* Get the head and any bytes after it as one block, copying only if it
+ * spans several buffers. The copy is returned in copy for the caller to
+ * free. */
+const char *request_data(const request_t *req, size_t *length, char **copy);
+/* Give the request's buffers back to the pool. */
+void request_free(request_t *req);
+
+/* Check if a span holds exactly str. */
+bool request_span_is(const iospan_t *span, const char *str);
+/* Check if a span contains token, ignoring case. */
+bool request_span_has(const iospan_t *span, const char *token);
+
+#endif
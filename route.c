@@ -0,0 +1,359 @@
+/*
+ * route.c - Source for the radix tree route table.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ *
+ * Routes are kept in a compressed radix tree keyed by path prefix. The tree
+ * is built while the options are parsed and only read afterwards, so
+ * lookups take no lock and cost depends on path length, not route count.
+ *
+ ****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "route.h"
+
+/* Radix tree node, children are sorted by the first byte of their label. */
+typedef struct route_node {
+	char *label;
+	size_t length;
+	route_t *prefix;
+	route_t *exact;
+	struct route_node **children;
+	size_t count;
+} route_node_t;
+
+static route_node_t root;
+
+/* ---------------------------- Private Functions ------------------------ */
+
+/* Find the child whose label starts with c, or where it would go.
+ */
+static size_t route_child_index(route_node_t *node, unsigned char c)
+{
+	size_t lo = 0, hi = node->count, mid;
+
+	while(lo < hi) {
+		mid = (lo + hi) / 2;
+		if((unsigned char)node->children[mid]->label[0] < c)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+/* Create a node with a copy of the given label.
+ */
+static route_node_t *route_node_create(const char *label, size_t length)
+{
+	route_node_t *node;
+
+	node = calloc(1, sizeof(route_node_t));
+	if(node == NULL)
+		return NULL;
+	node->label = malloc(length + 1);
+	if(node->label == NULL) {
+		free(node);
+		return NULL;
+	}
+	memcpy(node->label, label, length);
+	node->label[length] = '\0';
+	node->length = length;
+	return node;
+}
+/* Insert child into node at index.
+ */
+static int route_node_insert(route_node_t *node, size_t index,
+	route_node_t *child)
+{
+	route_node_t **tmp;
+
+	tmp = realloc(node->children, sizeof(route_node_t *) * (node->count + 1));
+	if(tmp == NULL)
+		return -1;
+	memmove(&tmp[index + 1], &tmp[index],
+		sizeof(route_node_t *) * (node->count - index));
+	tmp[index] = child;
+	node->children = tmp;
+	node->count++;
+	return 0;
+}
+/* Split child after length bytes of its label, returns the new parent.
+ */
+static route_node_t *route_node_split(route_node_t *node, size_t index,
+	size_t length)
+{
+	route_node_t *child = node->children[index], *mid;
+	char *label;
+
+	mid = route_node_create(child->label, length);
+	if(mid == NULL)
+		return NULL;
+	label = strdup(child->label + length);
+	mid->children = malloc(sizeof(route_node_t *));
+	if(label == NULL || mid->children == NULL) {
+		free(label);
+		free(mid->children);
+		free(mid->label);
+		free(mid);
+		return NULL;
+	}
+
+	free(child->label);
+	child->label = label;
+	child->length -= length;
+	mid->children[0] = child;
+	mid->count = 1;
+	node->children[index] = mid;
+	return mid;
+}
+/* Insert a route into the tree.
+ */
+static int route_insert(route_t *route)
+{
+	route_node_t *node = &root, *child;
+	const char *key = route->prefix;
+	size_t index, common;
+
+	for(;;) {
+		if(*key == '\0') {
+			route_t **slot = route->exact ? &node->exact : &node->prefix;
+
+			if(*slot != NULL)
+				return -1;
+			*slot = route;
+			return 0;
+		}
+
+		index = route_child_index(node, (unsigned char)*key);
+		if(index >= node->count || node->children[index]->label[0] != *key) {
+			child = route_node_create(key, strlen(key));
+			if(child == NULL || route_node_insert(node, index, child)) {
+				if(child != NULL)
+					free(child->label);
+				free(child);
+				return -1;
+			}
+			node = child;
+			key += child->length;
+			continue;
+		}
+
+		/* Follow the shared part of the label, splitting if needed */
+		child = node->children[index];
+		for(common = 0; common < child->length &&
+			key[common] == child->label[common]; common++);
+		if(common < child->length) {
+			child = route_node_split(node, index, common);
+			if(child == NULL)
+				return -1;
+		}
+		node = child;
+		key += common;
+	}
+}
+/* Create a route and insert it into the tree.
+ */
+static route_t *route_create(int type, const char *prefix, bool exact)
+{
+	route_t *route;
+
+	if(prefix == NULL || prefix[0] != '/')
+		return NULL;
+
+	route = calloc(1, sizeof(route_t));
+	if(route == NULL)
+		return NULL;
+	route->type = type;
+	route->exact = exact;
+	route->prefix = strdup(prefix);
+	if(route->prefix == NULL) {
+		free(route);
+		return NULL;
+	}
+	route->length = strlen(prefix);
+	if(route_insert(route)) {
+		free(route->prefix);
+		free(route);
+		return NULL;
+	}
+	return route;
+}
+/* Free a route.
+ */
+static void route_free(route_t *route)
+{
+	if(route != NULL) {
+		free(route->prefix);
+		free(route->target);
+		free(route);
+	}
+}
+/* Free a node and everything below it.
+ */
+static void route_node_free(route_node_t *node)
+{
+	size_t i;
+
+	for(i = 0; i < node->count; i++) {
+		route_node_free(node->children[i]);
+		free(node->children[i]);
+	}
+	free(node->children);
+	free(node->label);
+	route_free(node->prefix);
+	route_free(node->exact);
+	memset(node, 0, sizeof(route_node_t));
+}
+/* Check if a prefix route matches whole path segments, rest is what
+ * follows the prefix in the path.
+ */
+static bool route_prefix_matches(const route_t *route, const char *rest)
+{
+	return route->prefix[route->length - 1] == '/' || *rest == '\0' ||
+		*rest == '/' || *rest == '?';
+}
+
+/* ----------------------------- Public Functions ------------------------ */
+
+/* Serve files under prefix from directory.
+ */
+int route_add_static(const char *prefix, const char *dir)
+{
+	route_t *route;
+	char *target;
+	size_t length;
+
+	target = strdup(dir);
+	if(target == NULL)
+		return -1;
+
+	/* Drop trailing slash, the rest of the path is joined with one */
+	length = strlen(target);
+	if(length > 1 && target[length-1] == '/')
+		target[length-1] = '\0';
+
+	route = route_create(ROUTE_STATIC, prefix, false);
+	if(route == NULL) {
+		free(target);
+		return -1;
+	}
+	route->target = target;
+	return 0;
+}
+/* Redirect paths under prefix to location.
+ */
+int route_add_redirect(const char *prefix, unsigned short code,
+	const char *location)
+{
+	route_t *route;
+	char *target;
+
+	if(code != 301 && code != 302)
+		return -1;
+	target = strdup(location);
+	if(target == NULL)
+		return -1;
+
+	route = route_create(ROUTE_REDIRECT, prefix, false);
+	if(route == NULL) {
+		free(target);
+		return -1;
+	}
+	route->target = target;
+	route->code = code;
+	return 0;
+}
+/* Call a native handler for prefix, or only for the exact path.
+ */
+int route_add_handler(const char *prefix, bool exact, route_handler_t func,
+	void *arg)
+{
+	route_t *route;
+
+	if(func == NULL)
+		return -1;
+	route = route_create(ROUTE_HANDLER, prefix, exact);
+	if(route == NULL)
+		return -1;
+	route->func = func;
+	route->arg = arg;
+	return 0;
+}
+/* Hand paths under prefix to the reverse proxy route arg.
+ */
+int route_add_proxy(const char *prefix, void *arg)
+{
+	route_t *route;
+
+	route = route_create(ROUTE_PROXY, prefix, false);
+	if(route == NULL)
+		return -1;
+	route->arg = arg;
+	return 0;
+}
+/* Add a route given on the command line.
+ */
+int route_add_spec(const char *spec, int type)
+{
+	char buf[1024], *value, *end;
+	unsigned short code = 301;
+
+	if(spec == NULL || strlen(spec) >= sizeof(buf))
+		return -1;
+	strcpy(buf, spec);
+	value = strchr(buf, '=');
+	if(value == NULL || value[1] == '\0')
+		return -1;
+	*value++ = '\0';
+
+	if(type == ROUTE_STATIC)
+		return route_add_static(buf, value);
+	if(type != ROUTE_REDIRECT)
+		return -1;
+
+	/* Optional status code before the location */
+	if(strncmp(value, "301:", 4) == 0 || strncmp(value, "302:", 4) == 0) {
+		code = (unsigned short)strtoul(value, &end, 10);
+		value = end + 1;
+	}
+	return route_add_redirect(buf, code, value);
+}
+/* Find the route with the longest prefix matching path, a prefix not
+ * ending in a slash only matches up to one.
+ */
+const route_t *route_lookup(const char *path)
+{
+	const route_node_t *node = &root, *child;
+	const route_t *best = NULL;
+	size_t index;
+
+	for(;;) {
+		if(node->prefix != NULL && route_prefix_matches(node->prefix, path))
+			best = node->prefix;
+		if(*path == '\0')
+			return node->exact != NULL ? node->exact : best;
+
+		index = route_child_index((route_node_t *)node, (unsigned char)*path);
+		if(index >= node->count)
+			return best;
+		child = node->children[index];
+		if(child->label[0] != *path ||
+				strncmp(path, child->label, child->length) != 0)
+			return best;
+		path += child->length;
+		node = child;
+	}
+}
+/* Free the route table.
+ */
+void route_cleanup(void)
+{
+	route_node_free(&root);
+}
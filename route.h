@@ -0,0 +1,65 @@
+/*
+ * route.h - Header for the radix tree route table.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ */
+
+#ifndef ROUTE_H
+#define ROUTE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "network.h"
+
+/* Kinds of routes */
+enum {
+	ROUTE_STATIC,
+	ROUTE_REDIRECT,
+	ROUTE_HANDLER,
+	ROUTE_PROXY
+};
+
+/* Native request handler callback. */
+typedef void (*route_handler_t)(SOCKET fd, const char *path, void *arg);
+
+/* Route found by route_lookup(). */
+typedef struct route {
+	int type;
+	char *prefix;
+	size_t length;
+	bool exact;
+	char *target;
+	unsigned short code;
+	route_handler_t func;
+	void *arg;
+} route_t;
+
+/* Serve files under prefix from directory. */
+int route_add_static(const char *prefix, const char *dir);
+
+/* Redirect paths under prefix to location with code 301 or 302. */
+int route_add_redirect(const char *prefix, unsigned short code,
+	const char *location);
+
+/* Call a native handler for prefix, or only for the exact path. */
+int route_add_handler(const char *prefix, bool exact, route_handler_t func,
+	void *arg);
+
+/* Hand paths under prefix to the reverse proxy route arg. */
+int route_add_proxy(const char *prefix, void *arg);
+
+/* Add a route given on the command line, "/prefix/=dir" for a static
+ * mount or "/prefix=[301|302:]location" for a redirect. */
+int route_add_spec(const char *spec, int type);
+
+/* Find the route with the longest prefix matching whole segments of path. */
+const route_t *route_lookup(const char *path);
+
+/* Free the route table. */
+void route_cleanup(void);
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * route_bench.c - Benchmark for the radix tree route table.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "route.h"
+
+#define BENCH_LOOKUPS 1000000
+#define BENCH_PATHS 1024
+
+/* Get monotonic time in nanoseconds.
+ */
+static unsigned long long bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/* Build routes and time lookups against them.
+ */
+static int bench_run(int nroutes)
+{
+	static char paths[BENCH_PATHS][256];
+	unsigned long long t, hits = 0;
+	char path[256];
+	int i, j;
+
+	for(i = 0; i < nroutes; i++) {
+		snprintf(path, sizeof(path), "/api/v%d/service%d/", i % 7, i);
+		if(route_add_static(path, "/var/www")) {
+			fprintf(stderr, "Error: Could not add route '%s'.\n", path);
+			return -1;
+		}
+	}
+
+	/* Every other path misses, built up front so only lookups are timed */
+	for(i = 0; i < BENCH_PATHS; i++) {
+		j = rand() % nroutes;
+		snprintf(paths[i], sizeof(paths[i]), "/api/v%d/service%d/items/%d",
+			(j + i % 2) % 7, j, i);
+	}
+
+	t = bench_now();
+	for(i = 0; i < BENCH_LOOKUPS; i++)
+		if(route_lookup(paths[i % BENCH_PATHS]) != NULL)
+			hits++;
+	t = bench_now() - t;
+
+	printf("%7d routes: %8.1f ns/lookup (%llu hits)\n", nroutes,
+		(double)t / BENCH_LOOKUPS, hits);
+	route_cleanup();
+	return 0;
+}
+
+/* Entry point for the route benchmark.
+ */
+int main(void)
+{
+	int counts[] = { 10, 100, 1000, 10000, 100000 };
+	size_t i;
+
+	for(i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+		if(bench_run(counts[i]))
+			return 1;
+	return 0;
+}
@@ -0,0 +1,381 @@
+/*
+ * scoreboard.c - Source for the shared memory scoreboard.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ *
+ * The scoreboard is a POSIX shared memory segment that monitors map read
+ * only, so watching the server never touches its sockets. Each worker owns
+ * one slot and the global section has a single writer, every section is
+ * guarded by a sequence counter that is odd while a write is in progress.
+ * Writers never wait, readers retry until they get a stable copy.
+ *
+ ****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "scoreboard.h"
+
+static scoreboard_t *board;
+static char board_name[256];
+
+/* Current thread's slot */
+static _Thread_local scoreboard_slot_t *board_slot;
+
+/* ---------------------------- Private Functions ------------------------ */
+
+/* Get monotonic time in nanoseconds.
+ */
+static uint64_t scoreboard_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/* Start a write to a section guarded by seq.
+ */
+static uint32_t scoreboard_write_begin(_Atomic uint32_t *seq)
+{
+	uint32_t s = atomic_load_explicit(seq, memory_order_relaxed);
+
+	atomic_store_explicit(seq, s + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	return s + 2;
+}
+/* Finish a write started with scoreboard_write_begin().
+ */
+static void scoreboard_write_end(_Atomic uint32_t *seq, uint32_t s)
+{
+	atomic_store_explicit(seq, s, memory_order_release);
+}
+/* Copy a section guarded by seq, retrying while it is being written.
+ */
+static void scoreboard_read(const _Atomic uint32_t *seq, const void *src,
+	void *dst, size_t size)
+{
+	uint32_t s;
+
+	for(;;) {
+		s = atomic_load_explicit((_Atomic uint32_t *)seq,
+			memory_order_acquire);
+		if((s & 1) == 0) {
+			memcpy(dst, src, size);
+			atomic_thread_fence(memory_order_acquire);
+			if(atomic_load_explicit((_Atomic uint32_t *)seq,
+					memory_order_relaxed) == s)
+				return;
+		}
+		sched_yield();
+	}
+}
+
+/* Remove a scoreboard name left behind by a process that is gone, one
+ * of a running server is kept.
+ */
+static void scoreboard_unlink_stale(const char *name)
+{
+	const scoreboard_t *sb;
+	pid_t pid;
+
+	sb = scoreboard_open(name);
+	if(sb == NULL)
+		return;
+	pid = sb->pid;
+	scoreboard_close(sb);
+	if(pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH))
+		return;
+	shm_unlink(name);
+}
+/* Create a new sized segment under name, never taking over an existing
+ * one. Returns the descriptor or -1.
+ */
+static int scoreboard_segment(const char *name)
+{
+	int fd;
+
+	fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if(fd < 0)
+		return -1;
+	if(ftruncate(fd, sizeof(scoreboard_t))) {
+		close(fd);
+		shm_unlink(name);
+		return -1;
+	}
+	return fd;
+}
+
+/* ----------------------------- Public Functions ------------------------ */
+
+/* Create and map the scoreboard.
+ */
+int scoreboard_create(const char *name, int nslots, bool takeover)
+{
+	int fd;
+
+	if(name == NULL || strlen(name) >= sizeof(board_name) || nslots <= 0)
+		return -1;
+	if(nslots > SCOREBOARD_SLOTS)
+		nslots = SCOREBOARD_SLOTS;
+
+	/* After a handoff the old process keeps its own mapping */
+	if(takeover)
+		shm_unlink(name);
+	else
+		scoreboard_unlink_stale(name);
+	fd = scoreboard_segment(name);
+	if(fd < 0)
+		return -1;
+	board = mmap(NULL, sizeof(scoreboard_t), PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, 0);
+	close(fd);
+	if(board == MAP_FAILED) {
+		board = NULL;
+		shm_unlink(name);
+		return -1;
+	}
+
+	strcpy(board_name, name);
+	board->version = SCOREBOARD_VERSION;
+	board->nslots = nslots;
+	board->pid = getpid();
+	board->started = scoreboard_now();
+
+	/* Readers check the magic last */
+	atomic_store_explicit(&board->magic, SCOREBOARD_MAGIC,
+		memory_order_release);
+	return 0;
+}
+/* Unmap and remove the scoreboard.
+ */
+void scoreboard_destroy(void)
+{
+	if(board == NULL)
+		return;
+	munmap(board, sizeof(scoreboard_t));
+	if(board_name[0] != '\0')
+		shm_unlink(board_name);
+	board = NULL;
+}
+/* Leave the scoreboard name to the process that took over.
+ */
+void scoreboard_disown(void)
+{
+	board_name[0] = '\0';
+}
+/* Publish the scoreboard under its name again.
+ */
+int scoreboard_reclaim(void)
+{
+	scoreboard_t *copy;
+	void *p;
+	int fd, i;
+
+	if(board == NULL || board_name[0] == '\0')
+		return -1;
+	copy = malloc(sizeof(scoreboard_t));
+	if(copy == NULL)
+		return -1;
+
+	/* Writers may be halfway through a section, readers of the copy
+	 * must not wait for a write that finishes in the old segment
+	 */
+	memcpy(copy, board, sizeof(scoreboard_t));
+	for(i = 0; i < SCOREBOARD_SLOTS; i++)
+		copy->slots[i].seq = (copy->slots[i].seq + 1) & ~1U;
+	copy->global.seq = (copy->global.seq + 1) & ~1U;
+
+	/* Replace the mapping in place, slot pointers held by workers stay
+	 * valid and only updates made during the copy are lost
+	 */
+	shm_unlink(board_name);
+	fd = scoreboard_segment(board_name);
+	if(fd < 0) {
+		free(copy);
+		return -1;
+	}
+	p = MAP_FAILED;
+	if(pwrite(fd, copy, sizeof(scoreboard_t), 0) ==
+			(ssize_t)sizeof(scoreboard_t))
+		p = mmap(board, sizeof(scoreboard_t), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_FIXED, fd, 0);
+	close(fd);
+	free(copy);
+	if(p == MAP_FAILED) {
+		shm_unlink(board_name);
+		return -1;
+	}
+	return 0;
+}
+/* Make slot id the calling thread's slot.
+ */
+void scoreboard_attach(int id)
+{
+	if(board == NULL || id < 0 || id >= (int)board->nslots)
+		board_slot = NULL;
+	else
+		board_slot = &board->slots[id];
+}
+/* Set the calling thread's state and path.
+ */
+void scoreboard_state(int state, const char *path)
+{
+	scoreboard_slot_t *slot = board_slot;
+	uint32_t s;
+
+	if(slot == NULL)
+		return;
+
+	s = scoreboard_write_begin(&slot->seq);
+	slot->state = state;
+	slot->cpu = sched_getcpu();
+	slot->since = scoreboard_now();
+	if(path != NULL) {
+		strncpy(slot->path, path, SCOREBOARD_PATHLEN-1);
+		slot->path[SCOREBOARD_PATHLEN-1] = '\0';
+	}
+	else {
+		slot->path[0] = '\0';
+	}
+	scoreboard_write_end(&slot->seq, s);
+}
+/* Count bytes sent by the calling thread.
+ */
+void scoreboard_sent(size_t nbytes)
+{
+	scoreboard_slot_t *slot = board_slot;
+	uint32_t s;
+
+	if(slot == NULL)
+		return;
+
+	s = scoreboard_write_begin(&slot->seq);
+	slot->bytes += nbytes;
+	scoreboard_write_end(&slot->seq, s);
+}
+/* Count a request answered by the calling thread.
+ */
+void scoreboard_request(void)
+{
+	scoreboard_slot_t *slot = board_slot;
+	uint32_t s;
+
+	if(slot == NULL)
+		return;
+
+	s = scoreboard_write_begin(&slot->seq);
+	slot->requests++;
+	scoreboard_write_end(&slot->seq, s);
+}
+/* Go idle after a task, the last path is kept.
+ */
+void scoreboard_done(void)
+{
+	scoreboard_slot_t *slot = board_slot;
+	uint32_t s;
+
+	if(slot == NULL)
+		return;
+
+	s = scoreboard_write_begin(&slot->seq);
+	slot->state = SCOREBOARD_IDLE;
+	slot->since = scoreboard_now();
+	scoreboard_write_end(&slot->seq, s);
+}
+/* Publish lane and cache statistics.
+ */
+void scoreboard_publish(const threadpool_stats_t *lanes,
+	const cache_stats_t *cs)
+{
+	scoreboard_global_t *g;
+	uint32_t s;
+	int i;
+
+	if(board == NULL)
+		return;
+
+	g = &board->global;
+	s = scoreboard_write_begin(&g->seq);
+	g->updated = scoreboard_now();
+	for(i = 0; i < THREADPOOL_LANE_COUNT; i++) {
+		g->lanes[i].queued = lanes[i].queued;
+		g->lanes[i].active = lanes[i].active;
+		g->lanes[i].limit = lanes[i].limit;
+		g->lanes[i].completed = lanes[i].completed;
+		g->lanes[i].wait_avg = lanes[i].wait_avg;
+		g->lanes[i].p99 = lanes[i].p99;
+	}
+	g->cache_entries = cs->entries;
+	g->cache_bytes = cs->bytes;
+	g->cache_hits = cs->hits;
+	g->cache_misses = cs->misses;
+	g->cache_evictions = cs->evictions;
+	scoreboard_write_end(&g->seq, s);
+}
+/* Map an existing scoreboard read only, anything that is not a whole
+ * scoreboard is refused.
+ */
+const scoreboard_t *scoreboard_open(const char *name)
+{
+	scoreboard_t *sb;
+	struct stat st;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if(fd < 0)
+		return NULL;
+
+	/* Touching past the end of a short segment raises SIGBUS */
+	if(fstat(fd, &st) || st.st_size < (off_t)sizeof(scoreboard_t)) {
+		close(fd);
+		return NULL;
+	}
+	sb = mmap(NULL, sizeof(scoreboard_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(sb == MAP_FAILED)
+		return NULL;
+
+	if(atomic_load_explicit(&sb->magic, memory_order_acquire) !=
+			SCOREBOARD_MAGIC || sb->version != SCOREBOARD_VERSION ||
+			sb->nslots > SCOREBOARD_SLOTS) {
+		munmap(sb, sizeof(scoreboard_t));
+		return NULL;
+	}
+	return sb;
+}
+/* Unmap a scoreboard opened with scoreboard_open().
+ */
+void scoreboard_close(const scoreboard_t *sb)
+{
+	if(sb != NULL)
+		munmap((void *)sb, sizeof(scoreboard_t));
+}
+/* Take a consistent copy of a worker slot.
+ */
+void scoreboard_read_slot(const scoreboard_t *sb, int id,
+	scoreboard_slot_t *slot)
+{
+	scoreboard_read(&sb->slots[id].seq, &sb->slots[id], slot,
+		sizeof(scoreboard_slot_t));
+	slot->path[sizeof(slot->path)-1] = '\0';
+}
+/* Take a consistent copy of the global section.
+ */
+void scoreboard_read_global(const scoreboard_t *sb, scoreboard_global_t *g)
+{
+	scoreboard_read(&sb->global.seq, &sb->global, g,
+		sizeof(scoreboard_global_t));
+}
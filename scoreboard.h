@@ -0,0 +1,124 @@
+/*
+ * scoreboard.h - Header for the shared memory scoreboard.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ */
+
+#ifndef SCOREBOARD_H
+#define SCOREBOARD_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cache.h"
+#include "threadpool.h"
+
+/* Identifies a mapped scoreboard and its layout */
+#define SCOREBOARD_MAGIC 0x73687362U
+#define SCOREBOARD_VERSION 1
+
+/* Shared memory name, filled in with the port */
+#define SCOREBOARD_NAME "/shttpd-%hu"
+
+/* Most worker slots in a scoreboard */
+#define SCOREBOARD_SLOTS 64
+
+/* Longest request path kept in a slot */
+#define SCOREBOARD_PATHLEN 112
+
+/* Milliseconds between updates of the global section */
+#define SCOREBOARD_INTERVAL 250
+
+/* Worker states */
+enum {
+	SCOREBOARD_IDLE,
+	SCOREBOARD_READING,
+	SCOREBOARD_SENDING
+};
+
+/* Worker slot, written only by its worker. */
+typedef struct scoreboard_slot {
+	_Alignas(64) _Atomic uint32_t seq;
+	uint32_t state;
+	int32_t cpu;
+	uint64_t since;
+	uint64_t requests;
+	uint64_t bytes;
+	char path[SCOREBOARD_PATHLEN];
+} scoreboard_slot_t;
+
+/* Scheduler lane counters, times in microseconds. */
+typedef struct scoreboard_lane {
+	uint64_t queued;
+	uint64_t active;
+	uint64_t limit;
+	uint64_t completed;
+	uint64_t wait_avg;
+	uint64_t p99;
+} scoreboard_lane_t;
+
+/* Server wide counters, written by one thread every SCOREBOARD_INTERVAL. */
+typedef struct scoreboard_global {
+	_Alignas(64) _Atomic uint32_t seq;
+	uint64_t updated;
+	scoreboard_lane_t lanes[THREADPOOL_LANE_COUNT];
+	uint64_t cache_entries;
+	uint64_t cache_bytes;
+	uint64_t cache_hits;
+	uint64_t cache_misses;
+	uint64_t cache_evictions;
+} scoreboard_global_t;
+
+/* Layout of the shared memory segment. */
+typedef struct scoreboard {
+	_Atomic uint32_t magic;
+	uint32_t version;
+	uint32_t nslots;
+	int32_t pid;
+	uint64_t started;
+	scoreboard_global_t global;
+	scoreboard_slot_t slots[SCOREBOARD_SLOTS];
+} scoreboard_t;
+
+/* Create and map the scoreboard with nslots worker slots. A name held by
+ * a running server is left alone unless takeover is set, as it is for the
+ * process an upgrade handed over to. */
+int scoreboard_create(const char *name, int nslots, bool takeover);
+/* Unmap and remove the scoreboard. */
+void scoreboard_destroy(void);
+/* Keep the name when destroyed, a new process owns it after a handoff. */
+void scoreboard_disown(void);
+/* Publish the scoreboard under its name again, after a new process that
+ * took the name over failed to start. */
+int scoreboard_reclaim(void);
+
+/* Make slot id the calling thread's slot, -1 for none. */
+void scoreboard_attach(int id);
+/* Set the calling thread's state and path, NULL clears the path. */
+void scoreboard_state(int state, const char *path);
+/* Count bytes sent by the calling thread. */
+void scoreboard_sent(size_t nbytes);
+/* Count a request answered by the calling thread. */
+void scoreboard_request(void);
+/* Go idle after a task. */
+void scoreboard_done(void);
+/* Publish lane and cache statistics. */
+void scoreboard_publish(const threadpool_stats_t *lanes,
+	const cache_stats_t *cs);
+
+/* Map an existing scoreboard read only. */
+const scoreboard_t *scoreboard_open(const char *name);
+/* Unmap a scoreboard opened with scoreboard_open(). */
+void scoreboard_close(const scoreboard_t *sb);
+/* Take a consistent copy of a worker slot. */
+void scoreboard_read_slot(const scoreboard_t *sb, int id,
+	scoreboard_slot_t *slot);
+/* Take a consistent copy of the global section. */
+void scoreboard_read_global(const scoreboard_t *sb, scoreboard_global_t *g);
+
+#endif
@@ -10,10 +10,33 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <zlib.h>
 
 #include "abuffer.h"
+#include "bufpool.h"
+#include "cache.h"
+#include "capture.h"
+#include "conn.h"
 #include "network.h"
+#include "pipeline.h"
 #include "threadpool.h"
+#include "proxy.h"
+#include "ratelimit.h"
+#include "request.h"
+#include "route.h"
+#include "scoreboard.h"
+#include "trace.h"
+#include "upgrade.h"
+#include "vector.h"
+#include "vhost.h"
 #include "shttpd.h"
 
 /* ----------------------------- Response Stuff --------------------------- */
@@ -31,6 +54,10 @@ char *response_make(unsigned short value)
 	switch(value) {
 		case RESPONSE_OKAY:
 			return "OK";
+		case RESPONSE_MOVPERM:
+			return "Moved Permanently";
+		case RESPONSE_FOUND:
+			return "Found";
 		case RESPONSE_BADREQ:
 			return "Bad Request";
 		case RESPONSE_UNAUTH:
@@ -39,22 +66,22 @@ char *response_make(unsigned short value)
 			return "Forbidden";
 		case RESPONSE_NOTFOUND:
 			return "Not Found";
+		case RESPONSE_URITOOLONG:
+			return "URI Too Long";
+		case RESPONSE_TOOMANY:
+			return "Too Many Requests";
+		case RESPONSE_TOOLARGE:
+			return "Request Header Fields Too Large";
+		case RESPONSE_BADGATEWAY:
+			return "Bad Gateway";
+		case RESPONSE_UNAVAILABLE:
+			return "Service Unavailable";
 		default:
 			return "Unhandled";
 	}
 	return "<null>";
 }
 
-/* Initialize response structure.
- */
-response_t *response_init(void)
-{
-	static response_t r;
-	r.response = RESPONSE_OKAY;
-	r.ab = ab_init();
-	return &r;
-}
-
 /* Clear response structure.
  */
 void response_clear(response_t *r)
@@ -92,6 +119,75 @@ const char *response_getstr(response_t r)
 
 /* ------------------------------ Main Program -------------------------- */
 
+/* File transfer handed over to the bulk lane.
+ */
+struct transfer {
+	SOCKET fd;
+	FILE *fp;
+	bool keep;
+	char headers[256];
+};
+
+/* File to be compressed in the background.
+ */
+struct compress_job {
+	cache_t *cache;
+	char filename[1024];
+	long long mtime;
+	long long size;
+};
+
+/* Content types by file extension.
+ */
+static const struct {
+	const char *ext;
+	const char *type;
+	bool compress;
+} mime_types[] = {
+	{ ".html", "text/html", true },
+	{ ".htm", "text/html", true },
+	{ ".css", "text/css", true },
+	{ ".js", "application/javascript", true },
+	{ ".json", "application/json", true },
+	{ ".xml", "application/xml", true },
+	{ ".svg", "image/svg+xml", true },
+	{ ".txt", "text/plain", true },
+	{ ".png", "image/png", false },
+	{ ".jpg", "image/jpeg", false },
+	{ ".jpeg", "image/jpeg", false },
+	{ ".gif", "image/gif", false },
+	{ ".ico", "image/x-icon", false },
+	{ ".gz", "application/gzip", false }
+};
+
+/* Server settings */
+static threadpool_t *tpool;
+static bool two_lane;
+static long bulk_threshold = DEFAULT_BULK_THRESHOLD;
+static ratelimit_t *ratelimit;
+static bool steer;
+static _Atomic bool publishing;
+static volatile sig_atomic_t trace_pending;
+static volatile sig_atomic_t stopping;
+static volatile sig_atomic_t upgrade_pending;
+static _Atomic bool draining;
+static char exe_path[1024];
+static upgrade_t upgrade = { .pid = -1, .fd = INVALID_SOCKET };
+static uint64_t upgrade_capture;
+
+/* If the current worker's connection stays open after the response */
+static _Thread_local bool keep_alive;
+
+/* Responses queued for the current worker's connection, and whether more
+ * requests from it are waiting to be answered
+ */
+static _Thread_local pipeline_t *replies;
+static _Thread_local bool more_requests;
+
+/* Response for rate limited clients, built once at startup */
+static char too_many[128];
+static size_t too_many_len;
+
 /* Strip new line from buffer.
  */
 void strip(char *s)
@@ -103,135 +199,1267 @@ void strip(char *s)
 	}
 }
 
-/* Send response from server to client.
+/* Send every response queued for the current connection.
  */
-void send_response(SOCKET fd, response_t r)
+static void flush_replies(pipeline_t *pl)
 {
+	unsigned long long t;
+	bool failed;
 	long nbytes;
 
-	nbytes = send(fd, ab_getdata(r.ab), ab_getsize(r.ab), 0);
-	if(nbytes <= 0) {
-		if(nbytes < 0) {
+	if(pl->count == 0 && !pl->failed)
+		return;
+	t = trace_begin();
+	failed = pl->failed;
+	nbytes = pipeline_flush(pl);
+	if(nbytes > 0)
+		scoreboard_sent(nbytes);
+	if(nbytes < 0) {
+		/* The connection is marked failed, only report it the first time */
+		if(!failed)
 			fprintf(stderr, "Error: Failed to send data.\n");
-		}
-		else if(nbytes == 0) {
-			fprintf(stderr, "Connection closed.\n");
-		}
-		else if(nbytes != ab_getsize(r.ab)) {
-			fprintf(stderr, "Warning: Could not send all data.\n");
+		keep_alive = false;
+	}
+	trace_end("send", t);
+}
+
+/* Free an append buffer once its data was sent.
+ */
+static void release_buffer(void *arg, void *data)
+{
+	(void)data;
+	ab_free(arg);
+}
+
+/* Drop a cache entry reference once its data was sent.
+ */
+static void release_entry(void *arg, void *data)
+{
+	cache_release(arg, data);
+}
+
+/* Queue a response with extra headers and an optional body, release is
+ * called with arg and data once the body was sent. Every response is
+ * framed so the connection can be kept open afterwards. Responses on a
+ * connection without a queue are sent right away.
+ */
+static void queue_reply(SOCKET fd, unsigned short code, const char *headers,
+	const char *body, size_t length, pipeline_release_t release, void *arg,
+	void *data)
+{
+	pipeline_t single, *pl = replies;
+	char buffer[2560];
+
+	snprintf(buffer, sizeof(buffer)-1,
+		"HTTP/1.1 %hu %s\r\n%sContent-Length: %zu\r\nConnection: %s\r\n\r\n",
+		code, response_make(code), headers, length,
+		keep_alive ? "keep-alive" : "close");
+
+	if(pl == NULL || pl->fd != fd) {
+		pipeline_init(&single, fd);
+		pl = &single;
+	}
+	else if(pipeline_full(pl)) {
+		flush_replies(pl);
+	}
+	pipeline_push(pl, buffer, strlen(buffer), body, length, release, arg,
+		data);
+	if(pl == &single) {
+		flush_replies(pl);
+		pipeline_free(pl);
+	}
+}
+
+/* Send a response without a body.
+ */
+static void send_reply(SOCKET fd, unsigned short code, const char *headers)
+{
+	queue_reply(fd, code, headers, NULL, 0, NULL, NULL, NULL);
+}
+
+/* Send a response whose body is an append buffer, the buffer is freed
+ * once it was sent.
+ */
+static void send_buffer(SOCKET fd, const char *headers, AppendBuffer *ab)
+{
+	queue_reply(fd, RESPONSE_OKAY, headers, ab_getdata(ab), ab_getsize(ab),
+		release_buffer, ab, NULL);
+}
+
+/* Send a response with only a status line.
+ */
+static void send_error(SOCKET fd, unsigned short code)
+{
+	send_reply(fd, code, "");
+}
+
+/* Reject a rate limited client without touching the filesystem.
+ */
+static void send_too_many(SOCKET fd)
+{
+	send(fd, too_many, too_many_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+/* Check if client may make another request.
+ */
+static bool request_allowed(SOCKET fd)
+{
+	if(ratelimit == NULL)
+		return true;
+	return ratelimit_allow(ratelimit, conn_peer(fd), true);
+}
+
+/* Send okay response with extra headers and the contents of an open file.
+ */
+static void send_file(SOCKET fd, FILE *fp, const char *headers)
+{
+	char buffer[4096], *chunk;
+	AppendBuffer *ab;
+	size_t nbytes, size;
+	unsigned long long t;
+
+	/* Read through the worker's node local buffer when there is one */
+	chunk = threadpool_buffer(&size);
+	if(chunk == NULL) {
+		chunk = buffer;
+		size = sizeof(buffer);
+	}
+
+	ab = ab_init();
+	t = trace_begin();
+	while((nbytes = fread(chunk, 1, size, fp)) > 0) {
+		ab_append(ab, chunk, nbytes);
+	}
+	fclose(fp);
+	trace_end("read", t);
+
+	send_buffer(fd, headers, ab);
+}
+
+/* Get the content type of a file and if it is worth compressing.
+ */
+static const char *mime_type(const char *filename, bool *compress)
+{
+	const char *ext = strrchr(filename, '.');
+	size_t i;
+
+	*compress = false;
+	if(ext == NULL || strchr(ext, '/') != NULL)
+		return "application/octet-stream";
+
+	for(i = 0; i < sizeof(mime_types) / sizeof(mime_types[0]); i++) {
+		if(strcasecmp(ext, mime_types[i].ext) == 0) {
+			*compress = mime_types[i].compress;
+			return mime_types[i].type;
 		}
 	}
+	return "application/octet-stream";
 }
 
-/* Process request from client.
+/* Check if the request's Accept-Encoding allows gzip.
  */
-static void process_request(void *p)
+static bool accepts_gzip(const iospan_t *value)
 {
-	SOCKET fd = *(SOCKET*)p;
-	response_t r;
-	char buffer[4096];
-	int nbytes;
+	const char *p = value->ptr, *end = value->ptr + value->length;
 
-	r = *response_init();
+	if(p == NULL)
+		return false;
+	for(; p + 4 <= end && strncasecmp(p, "gzip", 4) != 0; p++);
+	if(p + 4 > end)
+		return false;
 
-	nbytes = recv(fd, buffer, sizeof(buffer)-1, 0);
-	if(nbytes <= 0) {
-		if(nbytes < 0)
-			printf("Error: Could not receive data.\n");
-		close(fd);
+	/* Refused with q=0 */
+	for(p += 4; p < end && *p == ' '; p++);
+	if(p < end && *p == ';') {
+		for(; p + 2 < end && *p != ',' && strncmp(p, "q=", 2) != 0; p++);
+		if(p + 2 < end && strncmp(p, "q=", 2) == 0)
+			return strtod(p + 2, NULL) > 0;
+	}
+	return true;
+}
+
+/* Find the virtual host named by the request's Host header.
+ */
+static vhost_t *request_vhost(const request_t *req)
+{
+	return vhost_find(req->host.ptr, req->host.length);
+}
+
+/* Record the request line and Host header when capturing traffic.
+ */
+static void capture_head(SOCKET fd, const request_t *req)
+{
+	const iospan_t *last;
+
+	if(!capture_enabled())
 		return;
+	last = req->version.length > 0 ? &req->version : &req->path;
+	capture_request(conn_id(fd), req->method.ptr,
+		last->ptr + last->length - req->method.ptr, req->host.ptr,
+		req->host.length, req->keep);
+}
+
+/* Get a file's modification time in nanoseconds, used as validator.
+ */
+static long long file_mtime(const struct stat *st)
+{
+	return (long long)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+/* Compress data into a newly allocated gzip stream.
+ */
+static char *gzip_compress(const char *src, size_t length, size_t *out)
+{
+	z_stream zs;
+	char *dst;
+	size_t bound;
+
+	memset(&zs, 0, sizeof(zs));
+	if(deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+			Z_DEFAULT_STRATEGY) != Z_OK)
+		return NULL;
+
+	bound = deflateBound(&zs, length);
+	dst = malloc(bound);
+	if(dst == NULL) {
+		deflateEnd(&zs);
+		return NULL;
 	}
-	else {
-		char path[1024];
 
-		/* Null terminate buffer and strip newlines */
-		buffer[nbytes] = '\0';
-		strip(buffer);
+	zs.next_in = (Bytef *)src;
+	zs.avail_in = length;
+	zs.next_out = (Bytef *)dst;
+	zs.avail_out = bound;
+	if(deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+		deflateEnd(&zs);
+		free(dst);
+		return NULL;
+	}
+	*out = zs.total_out;
+	deflateEnd(&zs);
+	return dst;
+}
+
+/* Compress a file into the gzip cache, run from the bulk lane.
+ */
+static void process_compress(void *p)
+{
+	struct compress_job *job = (struct compress_job *)p;
+	char *src, *data = NULL;
+	size_t length = 0;
+	struct stat st;
+	FILE *fp;
 
-		/* Process GET request */
-		if(sscanf(buffer, "GET %s HTTP/1.0", path) != 1) {
-			fprintf(stderr, "Error: Invalid request.\n");
+	fp = fopen(job->filename, "rbe");
+	if(fp != NULL) {
+		/* Only compress the version the cache slot was reserved for */
+		if(fstat(fileno(fp), &st) == 0 && file_mtime(&st) == job->mtime &&
+				st.st_size == job->size) {
+			src = malloc(job->size > 0 ? job->size : 1);
+			if(src != NULL && fread(src, 1, job->size, fp) == (size_t)job->size)
+				data = gzip_compress(src, job->size, &length);
+			free(src);
 		}
-		else {
-			char *endstr = strchr(path, '\n');
-			if(endstr != NULL) {
-				*endstr = '\0';
-			}
+		fclose(fp);
+	}
 
-			/* Check path to see if it's valid */
-			if(strncmp(path, "/", 1) == 0) {
-				char response[2048];
-				char filename[1024];
-				char dir[512];
-				FILE *fp;
-
-				/* Send okay response */
-				response_set(&r, RESPONSE_OKAY);
-				snprintf(response, sizeof(response)-1, "HTTP/1.0 %hu %s\r\n\r\n",
-					response_get(r), response_getstr(r));
-				ab_append(r.ab, response, strlen(response));
-				memset(filename, 0, sizeof(filename)-1);
-				getcwd(dir, sizeof(dir)-1);
-				strncpy(filename, dir, sizeof(filename)-1);
-				strcat(filename, "/");
-
-				if(path[0] == '/' && path[1] == '\0') {
-					strcat(filename, "index.html");
-				}
-				else if(path[0] == '/' && path[1] != '\0') {
-					strcat(filename, path);
-				}
+	/* Not worth keeping if it didn't get smaller */
+	if(data != NULL && length >= (size_t)job->size) {
+		free(data);
+		data = NULL;
+	}
+	cache_fill(job->cache, job->filename, CACHE_GZIP, job->mtime, job->size,
+		data, length);
+	free(job);
+}
 
-				fp = fopen(filename, "rt");
-				if(fp == NULL) {
-					fprintf(stderr, "Error: Can't find file '%s'.\n", filename);
-					close(fd);
-					return;
-				}
+/* Queue a file to be compressed on the bulk lane, the cache slot was
+ * reserved by cache_get().
+ */
+static void queue_compress(vhost_t *vh, const char *filename,
+	const struct stat *st)
+{
+	struct compress_job *job = NULL;
 
-				while((nbytes = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
-					ab_append(r.ab, buffer, nbytes);
-				}
+	if(st->st_size <= DEFAULT_GZIP_MAX)
+		job = malloc(sizeof(struct compress_job));
+	if(job != NULL) {
+		job->cache = vh->cache;
+		strncpy(job->filename, filename, sizeof(job->filename)-1);
+		job->filename[sizeof(job->filename)-1] = '\0';
+		job->mtime = file_mtime(st);
+		job->size = st->st_size;
+		if(threadpool_add_task_lane(tpool, THREADPOOL_LANE_BULK,
+				process_compress, job))
+			return;
+		free(job);
+	}
+	cache_fill(vh->cache, filename, CACHE_GZIP, file_mtime(st), st->st_size,
+		NULL, 0);
+}
+/* Send the gzip variant of a file if one is ready, otherwise queue it to
+ * be compressed in the background. Returns true if a response was sent.
+ */
+static bool send_gzip(SOCKET fd, vhost_t *vh, const char *filename,
+	const struct stat *st, const char *headers)
+{
+	char buffer[1280];
+	cache_entry_t *e;
+	bool fill;
+	FILE *fp;
+
+	snprintf(buffer, sizeof(buffer)-1, "%sContent-Encoding: gzip\r\n", headers);
+
+	/* Precompressed sidecar file */
+	if(strlen(filename) + 4 < 1024) {
+		char gzname[1024];
+
+		snprintf(gzname, sizeof(gzname), "%s.gz", filename);
+		fp = fopen(gzname, "rbe");
+		if(fp != NULL) {
+			send_file(fd, fp, buffer);
+			return true;
+		}
+	}
+
+	e = cache_get(vh->cache, filename, CACHE_GZIP, file_mtime(st), st->st_size,
+		&fill);
+	if(e != NULL) {
+		queue_reply(fd, RESPONSE_OKAY, buffer, cache_entry_data(e),
+			cache_entry_length(e), release_entry, vh->cache, e);
+		return true;
+	}
+	/* Never compress on the request path */
+	if(fill)
+		queue_compress(vh, filename, st);
+	return false;
+}
+
+/* Send per-lane scheduler statistics to client.
+ */
+static void send_status(SOCKET fd)
+{
+	static const char *lanes[THREADPOOL_LANE_COUNT] = { "fast", "bulk" };
+	threadpool_worker_stats_t ws[DEFAULT_WORKERS];
+	threadpool_stats_t st;
+	bufpool_stats_t bs;
+	conn_stats_t cs;
+	AppendBuffer *ab;
+	char line[512];
+	int i, n;
+
+	ab = ab_init();
+
+	for(i = 0; i < THREADPOOL_LANE_COUNT; i++) {
+		if(!threadpool_get_stats(tpool, i, &st))
+			continue;
+		snprintf(line, sizeof(line)-1,
+			"%s: queued=%zu active=%zu limit=%zu completed=%llu "
+			"wait_avg=%lluus run_avg=%lluus p50=%lluus p99=%lluus "
+			"max=%lluus\n", lanes[i], st.queued, st.active, st.limit,
+			st.completed, st.wait_avg, st.run_avg, st.p50, st.p99, st.max);
+		ab_append(ab, line, strlen(line));
+	}
+	n = (int)threadpool_get_workers(tpool, ws, DEFAULT_WORKERS);
+	for(i = 0; i < n; i++) {
+		snprintf(line, sizeof(line)-1,
+			"worker %d: cpu=%d node=%d steered=%llu stolen=%llu\n",
+			i, ws[i].cpu, ws[i].node, ws[i].steered, ws[i].stolen);
+		ab_append(ab, line, strlen(line));
+	}
+	bufpool_get_stats(&bs);
+	snprintf(line, sizeof(line)-1,
+		"buffers: slabs=%zu huge=%zu total=%zu free=%zu peak=%zu gets=%llu "
+		"exhausted=%llu\n", bs.slabs, bs.huge, bs.total, bs.free, bs.peak,
+		bs.gets, bs.exhausted);
+	ab_append(ab, line, strlen(line));
+	conn_get_stats(&cs);
+	snprintf(line, sizeof(line)-1,
+		"connections: open=%zu idle=%zu reused=%llu timeouts=%llu\n",
+		cs.open, cs.idle, cs.reused, cs.timeouts);
+	ab_append(ab, line, strlen(line));
+	vhost_stats(ab);
+	if(ratelimit != NULL) {
+		ratelimit_stats_t rs;
+
+		ratelimit_get_stats(ratelimit, &rs);
+		snprintf(line, sizeof(line)-1,
+			"ratelimit: allowed=%llu limited=%llu evicted=%llu\n",
+			rs.allowed, rs.limited, rs.evicted);
+		ab_append(ab, line, strlen(line));
+	}
+	proxy_stats(ab);
+	send_buffer(fd, "Content-Type: text/plain\r\n", ab);
+}
+
+/* Send a large file from the bulk lane.
+ */
+static void process_transfer(void *p)
+{
+	struct transfer *t = (struct transfer *)p;
+
+	scoreboard_attach(threadpool_worker_id());
+	scoreboard_state(SCOREBOARD_SENDING, NULL);
+	keep_alive = t->keep;
+	send_file(t->fd, t->fp, t->headers);
+	conn_finish(t->fd, keep_alive);
+	free(t);
+	scoreboard_request();
+	scoreboard_state(SCOREBOARD_IDLE, NULL);
+}
+
+/* Send a redirect to the route target.
+ */
+static void send_redirect(SOCKET fd, const route_t *route, const char *path)
+{
+	char buffer[2304];
+
+	snprintf(buffer, sizeof(buffer), "Location: %s%s\r\n", route->target,
+		route->exact ? "" : path + route->length);
+	send_reply(fd, route->code, buffer);
+}
+
+/* Send the server status page.
+ */
+static void handle_status(SOCKET fd, const char *path, void *arg)
+{
+	(void)path;
+	(void)arg;
+	send_status(fd);
+}
+
+/* Serve a file from disk or cache, returns true if the socket was handed
+ * to the bulk lane.
+ */
+static bool serve_file(SOCKET fd, vhost_t *vh, const char *filename,
+	bool gzip)
+{
+	unsigned long long t;
+	char headers[256];
+	const char *type;
+	struct stat st;
+	bool compress;
+	FILE *fp;
+
+	t = trace_begin();
+	fp = fopen(filename, "rte");
+	trace_end("open", t);
+	if(fp == NULL) {
+		fprintf(stderr, "Error: Can't find file '%s'.\n", filename);
+		send_error(fd, RESPONSE_NOTFOUND);
+		return false;
+	}
+
+	if(fstat(fileno(fp), &st) != 0) {
+		fclose(fp);
+		return false;
+	}
+
+	/* Compressible types vary by Accept-Encoding */
+	type = mime_type(filename, &compress);
+	snprintf(headers, sizeof(headers), "Content-Type: %s\r\n%s",
+		type, compress ? "Vary: Accept-Encoding\r\n" : "");
+	if(compress && gzip && send_gzip(fd, vh, filename, &st, headers)) {
+		fclose(fp);
+		return false;
+	}
+
+	/* Hand large files to the bulk lane, only the last of a pipelined
+	 * batch may go since the lane writes to the socket itself
+	 */
+	if(two_lane && !more_requests && st.st_size > bulk_threshold) {
+		struct transfer *xfer;
+
+		if(replies != NULL) {
+			flush_replies(replies);
+			if(replies->failed) {
 				fclose(fp);
-				send_response(fd, r);
+				return false;
 			}
-			else {
-				response_set(&r, RESPONSE_NOTFOUND);
-				fprintf(stderr, "GET %s : %hu - %s\n", path,
-					response_get(r), response_getstr(r));
-				send_response(fd, r);
+		}
+		xfer = malloc(sizeof(struct transfer));
+		if(xfer != NULL) {
+			xfer->fd = fd;
+			xfer->fp = fp;
+			xfer->keep = keep_alive;
+			strcpy(xfer->headers, headers);
+			if(threadpool_add_task_lane(tpool, THREADPOOL_LANE_BULK,
+					process_transfer, xfer))
+				return true;
+			free(xfer);
+		}
+	}
+	send_file(fd, fp, headers);
+	return false;
+}
+
+/* What happens to a connection once its request was handled */
+enum {
+	AFTER_CLOSE,
+	AFTER_KEEP,
+	AFTER_HANDED
+};
+
+/* Handle a parsed request, the request is freed. Returns what to do with
+ * the connection.
+ */
+static int handle_request(SOCKET fd, request_t *req)
+{
+	const route_t *route;
+	unsigned long long t;
+	char filename[2048];
+	char path[1024];
+	const char *rel, *data;
+	unsigned short code;
+	bool get, gzip, handed = false;
+	size_t length;
+	char *copy;
+	vhost_t *vh;
+
+	keep_alive = false;
+	capture_head(fd, req);
+
+	if(!request_allowed(fd)) {
+		flush_replies(replies);
+		send_too_many(fd);
+		request_free(req);
+		scoreboard_request();
+		return AFTER_CLOSE;
+	}
+
+	if(!request_path(req, path, sizeof(path))) {
+		send_error(fd, RESPONSE_URITOOLONG);
+		request_free(req);
+		scoreboard_request();
+		return AFTER_CLOSE;
+	}
+
+	t = trace_begin();
+	route = route_lookup(path);
+	trace_end("route", t);
+	scoreboard_state(SCOREBOARD_SENDING, path);
+
+	/* Proxied requests go upstream as received, body bytes included, after
+	 * the responses queued before them
+	 */
+	if(route != NULL && route->type == ROUTE_PROXY) {
+		flush_replies(replies);
+		t = trace_begin();
+		data = request_data(req, &length, &copy);
+		code = data != NULL ? proxy_forward(route->arg, fd, data,
+			(int)length) : RESPONSE_UNAVAILABLE;
+		free(copy);
+		trace_end("proxy", t);
+		request_free(req);
+		if(code != 0)
+			send_error(fd, code);
+		scoreboard_request();
+		return AFTER_CLOSE;
+	}
+
+	keep_alive = req->keep && !draining && conn_begin(fd);
+	vh = request_vhost(req);
+	gzip = vh->cache != NULL && accepts_gzip(&req->accept_encoding);
+	get = request_span_is(&req->method, "GET");
+
+	/* Done with the head, the buffers go back before sending */
+	request_free(req);
+
+	/* Process GET request */
+	if(!get) {
+		fprintf(stderr, "Error: Invalid request.\n");
+		keep_alive = false;
+		send_error(fd, RESPONSE_BADREQ);
+	}
+	else if(path[0] != '/') {
+		fprintf(stderr, "GET %s : %d - %s\n", path, RESPONSE_NOTFOUND,
+			response_make(RESPONSE_NOTFOUND));
+		send_error(fd, RESPONSE_NOTFOUND);
+	}
+	else if(strstr(path, "/..") != NULL) {
+		send_error(fd, RESPONSE_FORBIDDEN);
+	}
+	else if(route != NULL && route->type == ROUTE_HANDLER) {
+		route->func(fd, path, route->arg);
+	}
+	else if(route != NULL && route->type == ROUTE_REDIRECT) {
+		send_redirect(fd, route, path);
+	}
+	else {
+		/* Static mount or the host's document root */
+		t = trace_begin();
+		rel = route != NULL ? path + route->length : path;
+		while(*rel == '/')
+			rel++;
+		snprintf(filename, sizeof(filename), "%s/%s",
+			route != NULL ? route->target : vh->docroot,
+			*rel != '\0' ? rel : vh->index);
+		trace_end("resolve", t);
+		handed = serve_file(fd, vh, filename, gzip);
+	}
+
+	/* The bulk lane counts the request once it was sent */
+	if(handed)
+		return AFTER_HANDED;
+	scoreboard_request();
+	return keep_alive ? AFTER_KEEP : AFTER_CLOSE;
+}
+
+/* Read requests from a client and answer every complete one already
+ * received in one batch, until the connection is parked, closed or handed
+ * on. Returns what to do with the connection.
+ */
+static int handle_requests(SOCKET fd)
+{
+	request_t reqs[PIPELINE_MAX + 1];
+	unsigned long long t;
+	unsigned short code = 0;
+	int after = AFTER_CLOSE, i, n, rc;
+	bool next;
+	pipeline_t pl;
+
+	pipeline_init(&pl, fd);
+	replies = &pl;
+	request_init(&reqs[0]);
+	for(;;) {
+		keep_alive = false;
+		t = trace_begin();
+		rc = request_read(&reqs[0], fd, &code);
+		trace_end("recv", t);
+		if(rc <= 0) {
+			if(code != 0)
+				send_error(fd, code);
+			request_free(&reqs[0]);
+			after = AFTER_CLOSE;
+			break;
+		}
+
+		/* Parse whatever else the client already sent */
+		next = false;
+		for(n = 1, rc = 1; request_extra(&reqs[n-1]) > 0; n++) {
+			request_next(&reqs[n-1], &reqs[n]);
+			next = true;
+			if(n == PIPELINE_MAX)
+				break;
+			rc = request_parse(&reqs[n], &code);
+			if(rc <= 0)
+				break;
+			next = false;
+		}
+
+		for(i = 0; i < n; i++) {
+			more_requests = i + 1 < n || next;
+			after = handle_request(fd, &reqs[i]);
+			if(after != AFTER_KEEP || pl.failed)
+				break;
+		}
+		if(i < n)
+			after = after == AFTER_HANDED ? AFTER_HANDED : AFTER_CLOSE;
+
+		/* Answer a broken request after the ones before it */
+		if(after == AFTER_KEEP && rc < 0) {
+			keep_alive = false;
+			send_error(fd, code);
+			after = AFTER_CLOSE;
+		}
+
+		if(after != AFTER_KEEP || !next) {
+			for(i++; i < n; i++)
+				request_free(&reqs[i]);
+			if(next)
+				request_free(&reqs[n]);
+			break;
+		}
+
+		/* Wait for the rest of a partial request with the batch sent */
+		flush_replies(&pl);
+		if(pl.failed) {
+			request_free(&reqs[n]);
+			after = AFTER_CLOSE;
+			break;
+		}
+		reqs[0] = reqs[n];
+	}
+
+	flush_replies(&pl);
+	if(pl.failed && after == AFTER_KEEP)
+		after = AFTER_CLOSE;
+	pipeline_free(&pl);
+	replies = NULL;
+	more_requests = false;
+	return after;
+}
+
+/* Process request from client, keeping the worker's scoreboard slot up to
+ * date.
+ */
+static void process_request(void *p)
+{
+	SOCKET fd = (SOCKET)(intptr_t)p;
+	int after;
+
+	scoreboard_attach(threadpool_worker_id());
+	scoreboard_state(SCOREBOARD_READING, NULL);
+	after = handle_requests(fd);
+	if(after != AFTER_HANDED)
+		conn_finish(fd, after == AFTER_KEEP);
+	scoreboard_done();
+}
+
+/* Publish queue and cache statistics to the scoreboard.
+ */
+static void *publish_stats(void *arg)
+{
+	threadpool_stats_t lanes[THREADPOOL_LANE_COUNT];
+	struct timespec ts = { 0, SCOREBOARD_INTERVAL * 1000000L };
+	cache_stats_t cs;
+	int i;
+
+	(void)arg;
+	while(publishing) {
+		for(i = 0; i < THREADPOOL_LANE_COUNT; i++)
+			if(!threadpool_get_stats(tpool, i, &lanes[i]))
+				memset(&lanes[i], 0, sizeof(threadpool_stats_t));
+		vhost_get_stats(&cs);
+		scoreboard_publish(lanes, &cs);
+		nanosleep(&ts, NULL);
+	}
+	return NULL;
+}
+
+/* Warm up the paths a previous process served most, one
+ * "encoding<TAB>host<TAB>path" line each. Gzip variants are compressed on
+ * the bulk lane, the files themselves are read ahead into the page cache.
+ */
+static void prefetch_hot(char *list)
+{
+	char *line, *host, *path, *save = NULL;
+	cache_entry_t *e;
+	struct stat st;
+	vhost_t *vh;
+	bool fill;
+	int fd;
+
+	for(line = strtok_r(list, "\n", &save); line != NULL;
+			line = strtok_r(NULL, "\n", &save)) {
+		host = strchr(line, '\t');
+		path = host != NULL ? strchr(host + 1, '\t') : NULL;
+		if(path == NULL)
+			continue;
+		*host++ = '\0';
+		*path++ = '\0';
+
+		vh = *host == '\0' ? vhost_default() : vhost_find(host, strlen(host));
+		if(vh == NULL || vh->cache == NULL)
+			continue;
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if(fd < 0)
+			continue;
+		if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+			posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+			if(strtol(line, NULL, 10) == CACHE_GZIP) {
+				e = cache_get(vh->cache, path, CACHE_GZIP, file_mtime(&st),
+					st.st_size, &fill);
+				if(e != NULL)
+					cache_release(vh->cache, e);
+				else if(fill)
+					queue_compress(vh, path, &st);
 			}
 		}
+		close(fd);
 	}
-	close(fd);
+}
+/* Take the scoreboard name and trace back after a failed upgrade.
+ */
+static void restore_upgrade(const char *capture_path)
+{
+	/* The new process may have taken the scoreboard name already */
+	if(scoreboard_reclaim())
+		fprintf(stderr, "Warning: Cannot restore scoreboard.\n");
+	if(capture_path != NULL && capture_resume(capture_path, upgrade_capture))
+		fprintf(stderr, "Error: Cannot write capture '%s'.\n", capture_path);
+	fprintf(stderr, "Error: Upgrade failed, still serving.\n");
+}
+/* Hand the listening socket and hot paths to a new copy of the binary.
+ * Returns 0 once it was started, the capture is continued by it then.
+ */
+static int start_upgrade(SOCKET server, char *argv[],
+	const char *capture_path)
+{
+	upgrade_state_t st;
+	AppendBuffer *ab;
+	int rc;
+
+	ab = ab_init();
+	if(ab == NULL)
+		return -1;
+	vhost_hottest(ab, DEFAULT_HOT_PATHS);
+
+	memset(&st, 0, sizeof(st));
+	st.server = server;
+	st.next_conn = conn_next_id();
+	st.capture_started = upgrade_capture = capture_started();
+	st.hot = ab_getdata(ab);
+	st.hot_length = ab_getsize(ab);
+
+	/* One writer at a time, the new process appends to the trace */
+	capture_close();
+	rc = upgrade_spawn(&upgrade, exe_path, argv, &st);
+	ab_free(ab);
+	if(rc)
+		restore_upgrade(capture_path);
+	return rc;
+}
+
+/* Handle signals, work is deferred to the accept loop.
+ */
+static void handle_signal(int sig)
+{
+	if(sig == SIGUSR1)
+		trace_pending = 1;
+	else if(sig == SIGUSR2)
+		upgrade_pending = 1;
+	else
+		stopping = 1;
+}
+
+/* Parse a rate limit of the form "rate[:burst]".
+ */
+static int parse_rate(const char *s, unsigned int *rate, unsigned int *burst)
+{
+	char *end;
+
+	*rate = (unsigned int)strtoul(s, &end, 10);
+	*burst = *rate;
+	if(*end == ':')
+		*burst = (unsigned int)strtoul(end + 1, &end, 10);
+	return (*end != '\0' || *rate == 0 || *burst == 0) ? -1 : 0;
+}
+
+/* Parse a CPU list of the form "0-3,8".
+ */
+static int parse_cpus(const char *s, cpu_set_t *set)
+{
+	unsigned long first, last;
+	char *end;
+
+	CPU_ZERO(set);
+	do {
+		first = last = strtoul(s, &end, 10);
+		if(end == s)
+			return -1;
+		if(*end == '-')
+			last = strtoul(end + 1, &end, 10);
+		if(last < first || last >= CPU_SETSIZE)
+			return -1;
+		while(first <= last)
+			CPU_SET(first++, set);
+		s = end + 1;
+	} while(*end == ',');
+	return *end != '\0' ? -1 : 0;
+}
+
+/* Print usage information.
+ */
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-b bulk_workers] [-z bulk_bytes] "
+		"[-l backlog] [-p /prefix/=host:port]... [-r rate[:burst]] "
+		"[-R rate[:burst]] [-t sample] [-D trace_dir] [-c cache_bytes] "
+		"[-V host=docroot[,index[,cache_bytes]]]... [-m /prefix/=dir]... "
+		"[-e /prefix=[301|302:]location]... [-A cpus] [-L cpus] "
+		"[-S shm_name] [-B buffer_bytes] [-H] [-w capture_file] "
+		"[-T upstream_secs] [port]\n",
+		prog);
 }
 
 int main(int argc, char *argv[])
 {
-	unsigned short port = 8080;
-	SOCKET server, client;
-	threadpool_t *tpool;
+	unsigned short port = DEFAULT_PORT;
+	struct sockaddr_storage addrs[ACCEPT_BATCH];
+	unsigned int rate = 0, burst = 0, prefix_rate = 0, prefix_burst = 0;
+	struct sigaction sa;
+	cpu_set_t worker_cpus, listen_cpus;
+	bool pin_workers = false, pin_listener = false;
+	const char *board_name = NULL, *capture_path = NULL;
+	long pool_budget = DEFAULT_BUFFER_POOL;
+	bool huge = false, ready, listening = true;
+	time_t now, swept = 0, drained = 0;
+	upgrade_state_t handoff;
+	conn_stats_t cs;
+	char board_buf[64];
+	pthread_t publisher;
+	sigset_t mask;
+	SOCKET clients[ACCEPT_BATCH];
+	threadpool_job_t jobs[ACCEPT_BATCH];
+	int backlog = TCPSOCKET_BACKLOG;
+	long bulk_workers = 0, upstream_secs;
+	long gz_budget = DEFAULT_GZIP_CACHE;
+	const char **vhosts = NULL;
+	proxy_route_t *proxy;
+	char dir[512];
+	SOCKET server;
+	ssize_t length;
+	int c, i, j, n, m;
 
-	if(argc > 2) {
-		fprintf(stderr, "Usage: %s [port]\n", argv[0]);
+	while((c = getopt(argc, argv, "b:z:l:p:r:R:t:D:c:V:m:e:A:L:S:B:Hw:T:")) != -1) {
+		switch(c) {
+			case 'b':
+				bulk_workers = strtol(optarg, NULL, 10);
+				if(bulk_workers <= 0 || bulk_workers >= DEFAULT_WORKERS) {
+					fprintf(stderr, "Error: Bulk workers must be 1-%d.\n",
+						DEFAULT_WORKERS-1);
+					return 1;
+				}
+				two_lane = true;
+				break;
+			case 'z':
+				bulk_threshold = strtol(optarg, NULL, 10);
+				if(bulk_threshold <= 0) {
+					fprintf(stderr, "Error: Invalid bulk threshold.\n");
+					return 1;
+				}
+				break;
+			case 'l':
+				backlog = (int)strtol(optarg, NULL, 10);
+				if(backlog <= 0) {
+					fprintf(stderr, "Error: Invalid listen backlog.\n");
+					return 1;
+				}
+				break;
+			case 'p':
+				proxy = proxy_add_route(optarg);
+				if(proxy == NULL || route_add_proxy(proxy_route_prefix(proxy),
+						proxy)) {
+					fprintf(stderr, "Error: Invalid proxy route '%s'.\n",
+						optarg);
+					return 1;
+				}
+				break;
+			case 'r':
+				if(parse_rate(optarg, &rate, &burst)) {
+					fprintf(stderr, "Error: Invalid rate limit '%s'.\n", optarg);
+					return 1;
+				}
+				break;
+			case 'R':
+				if(parse_rate(optarg, &prefix_rate, &prefix_burst)) {
+					fprintf(stderr, "Error: Invalid rate limit '%s'.\n", optarg);
+					return 1;
+				}
+				break;
+			case 't':
+				trace_set_sample((unsigned int)strtoul(optarg, NULL, 10));
+				break;
+			case 'D':
+				if(trace_set_dir(optarg)) {
+					fprintf(stderr, "Error: Invalid trace directory '%s'.\n",
+						optarg);
+					return 1;
+				}
+				break;
+			case 'c':
+				gz_budget = strtol(optarg, NULL, 10);
+				if(gz_budget < 0) {
+					fprintf(stderr, "Error: Invalid cache size.\n");
+					return 1;
+				}
+				break;
+			case 'V':
+				vector_add(vhosts, optarg);
+				break;
+			case 'm':
+			case 'e':
+				if(route_add_spec(optarg, c == 'm' ? ROUTE_STATIC :
+						ROUTE_REDIRECT)) {
+					fprintf(stderr, "Error: Invalid route '%s'.\n", optarg);
+					return 1;
+				}
+				break;
+			case 'A':
+			case 'L':
+				if(parse_cpus(optarg, c == 'A' ? &worker_cpus : &listen_cpus)) {
+					fprintf(stderr, "Error: Invalid CPU list '%s'.\n", optarg);
+					return 1;
+				}
+				if(c == 'A')
+					pin_workers = true;
+				else
+					pin_listener = true;
+				break;
+			case 'S':
+				board_name = optarg;
+				break;
+			case 'B':
+				pool_budget = strtol(optarg, NULL, 10);
+				if(pool_budget <= 0) {
+					fprintf(stderr, "Error: Invalid buffer pool size.\n");
+					return 1;
+				}
+				break;
+			case 'H':
+				huge = true;
+				break;
+			case 'w':
+				capture_path = optarg;
+				break;
+			case 'T':
+				upstream_secs = strtol(optarg, NULL, 10);
+				if(upstream_secs <= 0 || upstream_secs > 86400) {
+					fprintf(stderr, "Error: Invalid upstream timeout.\n");
+					return 1;
+				}
+				proxy_set_timeout((int)upstream_secs);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if(argc - optind > 1) {
+		usage(argv[0]);
 		return 1;
 	}
+	if(optind < argc)
+		port = (unsigned short)strtoul(argv[optind], NULL, 10);
 
-	server = server_socket_open(&port);
-	if(server == INVALID_SOCKET)
+	if(rate || prefix_rate) {
+		ratelimit = ratelimit_create(rate, burst, prefix_rate, prefix_burst);
+		if(ratelimit == NULL) {
+			fprintf(stderr, "Error: Cannot create rate limiter.\n");
+			return 1;
+		}
+	}
+	/* Hosts are set up once, lookups never lock */
+	if(getcwd(dir, sizeof(dir)) == NULL ||
+			vhost_set_default(dir, "index.html", gz_budget)) {
+		fprintf(stderr, "Error: Cannot set up default host.\n");
 		return 1;
+	}
+	for(i = 0; i < (int)vector_count(vhosts); i++) {
+		if(vhost_add(vhosts[i], gz_budget)) {
+			fprintf(stderr, "Error: Invalid virtual host '%s'.\n", vhosts[i]);
+			return 1;
+		}
+	}
+	vector_free(vhosts);
+	route_add_handler("/server-status", true, handle_status, NULL);
+	too_many_len = snprintf(too_many, sizeof(too_many),
+		"HTTP/1.1 %d %s\r\nRetry-After: 1\r\nContent-Length: 0\r\n"
+		"Connection: close\r\n\r\n",
+		RESPONSE_TOOMANY, response_make(RESPONSE_TOOMANY));
 
-	tpool = threadpool_create(5);
-	while(1) {
-		client = server_socket_accept(server);
-		if(client == INVALID_SOCKET)
+	if(bufpool_init(pool_budget, huge)) {
+		fprintf(stderr, "Error: Cannot set up buffer pool.\n");
+		return 1;
+	}
+
+	/* An upgrade runs this binary again, wherever it was moved to */
+	length = readlink("/proc/self/exe", exe_path, sizeof(exe_path)-1);
+	if(length > 0)
+		exe_path[length] = '\0';
+	else
+		snprintf(exe_path, sizeof(exe_path), "%s", argv[0]);
+
+	/* Started by an upgrade the listening socket is inherited */
+	switch(upgrade_receive(&handoff)) {
+		case 1:
+			server = handoff.server;
+			if(handoff.port != 0)
+				port = handoff.port;
+			conn_set_next_id(handoff.next_conn);
+			break;
+		case 0:
+			server = server_socket_open_backlog(&port, backlog);
+			if(server == INVALID_SOCKET)
+				return 1;
 			break;
+		default:
+			fprintf(stderr, "Error: Cannot take over from old process.\n");
+			return 1;
+	}
+	if(capture_path != NULL && (handoff.capture_started != 0 ?
+			capture_resume(capture_path, handoff.capture_started) :
+			capture_open(capture_path))) {
+		fprintf(stderr, "Error: Cannot write capture '%s'.\n", capture_path);
+		close(server);
+		return 1;
+	}
+	if(fcntl(server, F_SETFD, FD_CLOEXEC) || socket_set_nonblock(server) ||
+			conn_init(server)) {
+		close(server);
+		return 1;
+	}
+
+	/* SIGUSR1 toggles tracing, SIGUSR2 upgrades and SIGINT/SIGTERM stop
+	 * the server, only the accept loop may take them
+	 */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR1, &sa, NULL);
+	sigaction(SIGUSR2, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGUSR2);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
 
-		threadpool_add_task(tpool, process_request, &client);
+	/* Monitors find the scoreboard by port unless named otherwise */
+	if(board_name == NULL) {
+		snprintf(board_buf, sizeof(board_buf), SCOREBOARD_NAME, port);
+		board_name = board_buf;
+	}
+	if(scoreboard_create(board_name, DEFAULT_WORKERS,
+			handoff.server != INVALID_SOCKET))
+		fprintf(stderr, "Warning: Cannot create scoreboard '%s'.\n",
+			board_name);
+
+	tpool = threadpool_create_pinned(DEFAULT_WORKERS,
+		pin_workers ? &worker_cpus : NULL);
+	if(tpool != NULL) {
+		publishing = true;
+		if(pthread_create(&publisher, NULL, publish_stats, NULL))
+			publishing = false;
+	}
+	pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+	if(tpool == NULL) {
+		fprintf(stderr, "Error: Cannot create thread pool.\n");
+		scoreboard_destroy();
+		close(server);
+		return 1;
 	}
+	/* Workers set their own affinity, so pinning here only moves us */
+	if(pin_listener && pthread_setaffinity_np(pthread_self(),
+			sizeof(cpu_set_t), &listen_cpus)) {
+		fprintf(stderr, "Error: Cannot pin listener.\n");
+		if(publishing) {
+			publishing = false;
+			pthread_join(publisher, NULL);
+		}
+		threadpool_destroy(tpool);
+		scoreboard_destroy();
+		free(handoff.hot);
+		close(server);
+		return 1;
+	}
+	/* Hand connections to the worker on the CPU their packets arrive on */
+	steer = pin_workers;
+	if(two_lane)
+		threadpool_set_lane_limit(tpool, THREADPOOL_LANE_BULK, bulk_workers);
+
+	/* Let the old process go once the hot paths are on their way */
+	if(handoff.hot != NULL)
+		prefetch_hot(handoff.hot);
+	free(handoff.hot);
+	upgrade_ready();
 
+	while(!stopping) {
+		/* Parked connections with a new request come first */
+		/* Look for the new process' answer often while upgrading */
+		n = conn_wait(clients, ACCEPT_BATCH, &ready,
+			upgrade.fd != INVALID_SOCKET ? 50 : 1000);
+		if(n < 0)
+			break;
+
+		if(trace_pending) {
+			trace_pending = 0;
+			trace_toggle();
+		}
+		if(upgrade_pending) {
+			upgrade_pending = 0;
+			if(listening && upgrade.fd == INVALID_SOCKET)
+				start_upgrade(server, argv, capture_path);
+		}
+		if(upgrade.fd != INVALID_SOCKET) {
+			switch(upgrade_check(&upgrade)) {
+				case 1:
+					/* The new process accepts from here on */
+					fprintf(stderr, "Upgraded to pid %d, draining.\n",
+						(int)upgrade.pid);
+					draining = true;
+					listening = false;
+					conn_stop_accept();
+					close(server);
+					conn_close_idle();
+					scoreboard_disown();
+					drained = time(NULL) + UPGRADE_DRAIN_SECS;
+					break;
+				case -1:
+					restore_upgrade(capture_path);
+					break;
+			}
+		}
+
+		m = 0;
+		if(ready && listening) {
+			m = server_socket_accept_ready(server, clients + n, addrs,
+				ACCEPT_BATCH - n);
+			if(m < 0)
+				break;
+		}
+
+		/* Pass descriptors by value, clients is reused next round */
+		for(i = j = 0; i < n + m; i++) {
+			if(i >= n) {
+				if(ratelimit != NULL && !ratelimit_allow(ratelimit,
+						(struct sockaddr *)&addrs[i - n], false)) {
+					send_too_many(clients[i]);
+					close(clients[i]);
+					continue;
+				}
+				conn_open(clients[i], (struct sockaddr *)&addrs[i - n]);
+			}
+			clients[j] = clients[i];
+			jobs[j].func = process_request;
+			jobs[j].arg = (void *)(intptr_t)clients[i];
+			jobs[j].cpu = steer ? socket_incoming_cpu(clients[i]) : -1;
+			j++;
+		}
+		if(j > 0 && !threadpool_add_tasks(tpool, jobs, j)) {
+			for(i = 0; i < j; i++)
+				conn_close(clients[i]);
+		}
+
+		/* Time out idle connections about once a second */
+		/* Connections parked while draining are closed, leave once none
+		 * is left
+		 */
+		now = time(NULL);
+		if(now != swept) {
+			conn_sweep();
+			swept = now;
+			if(draining) {
+				conn_get_stats(&cs);
+				if(cs.open == 0 || now >= drained)
+					break;
+				conn_close_idle();
+			}
+		}
+	}
+
+	if(upgrade.fd != INVALID_SOCKET)
+		upgrade_abort(&upgrade);
+	if(publishing) {
+		publishing = false;
+		pthread_join(publisher, NULL);
+	}
 	threadpool_wait(tpool);
 	threadpool_destroy(tpool);
-	close(server);
+	trace_wait();
+	conn_cleanup();
+	capture_close();
+	bufpool_cleanup();
+	scoreboard_destroy();
+	proxy_cleanup();
+	ratelimit_destroy(ratelimit);
+	vhost_cleanup();
+	route_cleanup();
+	if(listening)
+		close(server);
 	return 0;
 }
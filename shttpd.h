@@ -10,6 +10,25 @@
 #define SHTTPD_H
 
 #define DEFAULT_PORT 8080
+#define DEFAULT_WORKERS 5
+
+/* Most connections accepted and queued per wakeup */
+#define ACCEPT_BATCH 64
+
+/* Files larger than this are sent from the bulk lane in two-lane mode */
+#define DEFAULT_BULK_THRESHOLD (64 * 1024)
+
+/* Byte budget of the compressed variant cache */
+#define DEFAULT_GZIP_CACHE (8 * 1024 * 1024)
+
+/* Largest file compressed in the background */
+#define DEFAULT_GZIP_MAX (1024 * 1024)
+
+/* Byte budget of the receive buffer pool */
+#define DEFAULT_BUFFER_POOL (16 * 1024 * 1024)
+
+/* Most cached paths per host handed to a new binary to warm up */
+#define DEFAULT_HOT_PATHS 128
 
 /* Response requests */
 enum {
@@ -19,7 +38,12 @@ enum {
 	RESPONSE_BADREQ = 400,
 	RESPONSE_UNAUTH = 401,
 	RESPONSE_FORBIDDEN = 403,
-	RESPONSE_NOTFOUND = 404
+	RESPONSE_NOTFOUND = 404,
+	RESPONSE_URITOOLONG = 414,
+	RESPONSE_TOOMANY = 429,
+	RESPONSE_TOOLARGE = 431,
+	RESPONSE_BADGATEWAY = 502,
+	RESPONSE_UNAVAILABLE = 503
 };
 
 /* Forward declaration for response structure */
@@ -29,7 +53,6 @@ struct response;
 typedef struct response response_t;
 
 /* Response functions */
-response_t *response_init(void);
 void response_clear(response_t *r);
 unsigned short response_get(response_t r);
 const char *response_getstr(response_t r);
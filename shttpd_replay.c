@@ -0,0 +1,833 @@
+/*
+ * shttpd_replay.c - Replay a captured trace against a server.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ *
+ * Requests are sent at their recorded arrival times, divided by the speed
+ * factor. Each recorded connection gets its own client connection and its
+ * requests go over it in order, one at a time, so reuse matches the trace.
+ * A connection the server closes is reopened for the next request. One
+ * epoll loop drives every connection and never blocks on a socket, so the
+ * replay adds little latency of its own. A request not answered within the
+ * timeout counts as an error and its connection is dropped.
+ *
+ ****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/epoll.h>
+
+#include "capture.h"
+#include "network.h"
+
+/* Paths shown in the breakdown by default */
+#define REPLAY_PATHS 20
+
+/* Longest response head that is parsed */
+#define REPLAY_HEADSIZE 8192
+
+/* Default seconds a request may take before it counts as failed */
+#define REPLAY_TIMEOUT 10
+
+/* Client connection states */
+enum {
+	REPLAY_IDLE,
+	REPLAY_CONNECTING,
+	REPLAY_SENDING,
+	REPLAY_WAITING
+};
+
+/* One request from the trace and its outcome. */
+typedef struct replay_request {
+	uint64_t due;
+	char *line;
+	char *host;
+	char *path;
+	bool keep;
+	bool ready;
+	bool done;
+	int client;
+	int next;
+	int status;
+	uint64_t bytes;
+	uint64_t latency;
+} replay_request_t;
+
+/* One client connection, standing in for a recorded connection. */
+typedef struct replay_client {
+	SOCKET fd;
+	int state;
+	int next;
+	uint64_t started;
+	uint64_t deadline;
+	char *out;
+	size_t olen;
+	size_t opos;
+	char head[REPLAY_HEADSIZE];
+	size_t hlen;
+	bool header_done;
+	bool close;
+	bool reused;
+	int status;
+	uint64_t bytes;
+	long long remaining;
+} replay_client_t;
+
+/* Deadline of a started request, kept in the order they were started. */
+typedef struct replay_timer {
+	int client;
+	int req;
+	uint64_t deadline;
+} replay_timer_t;
+
+/* Totals for one path. */
+typedef struct replay_path {
+	const char *path;
+	size_t count;
+	size_t errors;
+	uint64_t bytes;
+	uint64_t mean;
+	uint64_t p50;
+	uint64_t p99;
+	uint64_t max;
+} replay_path_t;
+
+static replay_request_t *reqs;
+static replay_client_t *clients;
+static size_t nreqs, nclients, ndone, nrun;
+static int *runq;
+static replay_timer_t *timers;
+static size_t ntimers, timer_head;
+static uint64_t request_timeout = REPLAY_TIMEOUT * 1000000ULL;
+static unsigned long long nconnects, nerrors, ntimeouts;
+static struct sockaddr_in target;
+static const char *target_name;
+static int epfd;
+
+/* Get monotonic time in microseconds.
+ */
+static uint64_t replay_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+/* Get the path of a request line without the query string.
+ */
+static char *replay_path(const char *line)
+{
+	const char *p, *end;
+	char *path;
+
+	p = strchr(line, ' ');
+	p = p != NULL ? p + 1 : line;
+	for(end = p; *end != '\0' && *end != ' ' && *end != '?'; end++);
+	path = malloc(end - p + 1);
+	if(path != NULL) {
+		memcpy(path, p, end - p);
+		path[end - p] = '\0';
+	}
+	return path;
+}
+/* Load a trace, requests on the same recorded connection are chained to
+ * the same client.
+ */
+static int replay_load(const char *file)
+{
+	capture_record_t rec;
+	size_t size = 0, cap, slot, i;
+	uint32_t *ids = NULL;
+	int *last = NULL;
+	FILE *fp;
+	int rc;
+
+	fp = fopen(file, "rb");
+	if(fp == NULL || capture_check(fp)) {
+		if(fp != NULL)
+			fclose(fp);
+		return -1;
+	}
+
+	while((rc = capture_read(fp, &rec)) > 0) {
+		if(nreqs == size) {
+			replay_request_t *tmp;
+
+			size = size ? size * 2 : 1024;
+			tmp = realloc(reqs, size * sizeof(replay_request_t));
+			if(tmp == NULL) {
+				rc = -1;
+				break;
+			}
+			reqs = tmp;
+		}
+		memset(&reqs[nreqs], 0, sizeof(replay_request_t));
+		reqs[nreqs].due = rec.usec;
+		reqs[nreqs].keep = (rec.flags & CAPTURE_KEEP) != 0;
+		reqs[nreqs].line = strdup(rec.line);
+		reqs[nreqs].host = strdup(rec.host);
+		reqs[nreqs].path = replay_path(rec.line);
+		reqs[nreqs].client = (int)rec.conn;
+		reqs[nreqs].next = -1;
+		if(reqs[nreqs].line == NULL || reqs[nreqs].host == NULL ||
+				reqs[nreqs].path == NULL) {
+			rc = -1;
+			break;
+		}
+		nreqs++;
+	}
+	fclose(fp);
+	if(rc < 0)
+		return -1;
+
+	/* Map recorded connection numbers to clients, 0 was never tracked */
+	cap = 16;
+	while(cap < nreqs * 2)
+		cap *= 2;
+	ids = calloc(cap, sizeof(uint32_t));
+	last = malloc(cap * sizeof(int));
+	clients = calloc(nreqs > 0 ? nreqs : 1, sizeof(replay_client_t));
+	if(ids == NULL || last == NULL || clients == NULL) {
+		free(ids);
+		free(last);
+		return -1;
+	}
+
+	for(i = 0; i < nreqs; i++) {
+		uint32_t id = (uint32_t)reqs[i].client;
+
+		slot = (id * 2654435761U) & (cap - 1);
+		while(id != 0 && ids[slot] != 0 && ids[slot] != id)
+			slot = (slot + 1) & (cap - 1);
+		if(id != 0 && ids[slot] == id) {
+			reqs[i].client = reqs[last[slot]].client;
+			reqs[last[slot]].next = (int)i;
+			last[slot] = (int)i;
+			continue;
+		}
+
+		reqs[i].client = (int)nclients;
+		clients[nclients].fd = INVALID_SOCKET;
+		clients[nclients].next = (int)i;
+		nclients++;
+		if(id != 0) {
+			ids[slot] = id;
+			last[slot] = (int)i;
+		}
+	}
+	free(ids);
+	free(last);
+	return 0;
+}
+/* Order request indices by due time.
+ */
+static int replay_cmp_due(const void *a, const void *b)
+{
+	const replay_request_t *x = &reqs[*(const int *)a];
+	const replay_request_t *y = &reqs[*(const int *)b];
+
+	if(x->due != y->due)
+		return x->due < y->due ? -1 : 1;
+	return *(const int *)a - *(const int *)b;
+}
+/* Drop a client's connection.
+ */
+static void replay_disconnect(replay_client_t *c)
+{
+	if(c->fd != INVALID_SOCKET) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+		close(c->fd);
+		c->fd = INVALID_SOCKET;
+	}
+	free(c->out);
+	c->out = NULL;
+	c->state = REPLAY_IDLE;
+}
+/* Send as much of the client's request as the socket takes, waiting for
+ * EPOLLOUT for the rest. Returns false if the connection failed.
+ */
+static bool replay_flush(replay_client_t *c)
+{
+	struct epoll_event ev;
+	long nbytes;
+
+	while(c->opos < c->olen) {
+		nbytes = send(c->fd, c->out + c->opos, c->olen - c->opos,
+			MSG_NOSIGNAL);
+		if(nbytes > 0) {
+			c->opos += nbytes;
+			continue;
+		}
+		if(nbytes < 0 && errno == EINTR)
+			continue;
+		if(nbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			ev.events = EPOLLOUT;
+			ev.data.ptr = c;
+			return epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) == 0;
+		}
+		return false;
+	}
+
+	free(c->out);
+	c->out = NULL;
+	c->state = REPLAY_WAITING;
+	ev.events = EPOLLIN | EPOLLRDHUP;
+	ev.data.ptr = c;
+	return epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) == 0;
+}
+/* Send the client's current request.
+ */
+static bool replay_send(replay_client_t *c)
+{
+	replay_request_t *r = &reqs[c->next];
+	size_t size = CAPTURE_LINE_MAX + CAPTURE_HOST_MAX + 128;
+	const char *version;
+	int length;
+
+	/* Request lines without a version were HTTP/0.9 style */
+	version = strchr(r->line, ' ');
+	if(version != NULL)
+		version = strchr(version + 1, ' ');
+	free(c->out);
+	c->out = malloc(size);
+	if(c->out == NULL)
+		return false;
+	length = snprintf(c->out, size, "%s%s\r\nHost: %s\r\n"
+		"User-Agent: shttpd-replay\r\nConnection: %s\r\n\r\n", r->line,
+		version != NULL ? "" : " HTTP/1.0",
+		r->host[0] != '\0' ? r->host : target_name,
+		r->keep ? "keep-alive" : "close");
+	c->olen = length < (int)size ? (size_t)length : size - 1;
+	c->opos = 0;
+
+	c->hlen = 0;
+	c->header_done = false;
+	c->close = !r->keep;
+	c->remaining = -1;
+	c->state = REPLAY_SENDING;
+	return replay_flush(c);
+}
+/* Finish the client's current request and start the next one if due.
+ */
+static void replay_complete(replay_client_t *c, int status, uint64_t bytes)
+{
+	replay_request_t *r = &reqs[c->next];
+
+	r->status = status;
+	r->bytes = bytes;
+	r->latency = replay_now() - c->started;
+	r->done = true;
+	if(status == 0)
+		nerrors++;
+	ndone++;
+
+	if(status == 0 || c->close)
+		replay_disconnect(c);
+	else
+		c->state = REPLAY_IDLE;
+
+	/* Queue the next request on this connection if it is already due */
+	c->next = r->next;
+	if(c->next >= 0 && reqs[c->next].ready)
+		runq[nrun++] = (int)(c - clients);
+}
+/* Start the client's next request, connecting first when needed.
+ */
+static void replay_start(replay_client_t *c)
+{
+	struct epoll_event ev;
+	replay_timer_t *t;
+
+	/* Requests all get the same timeout, so deadlines come in order */
+	c->started = replay_now();
+	c->deadline = c->started + request_timeout;
+	t = &timers[ntimers++];
+	t->client = (int)(c - clients);
+	t->req = c->next;
+	t->deadline = c->deadline;
+
+	c->reused = c->fd != INVALID_SOCKET;
+	if(c->reused) {
+		if(!replay_send(c))
+			replay_complete(c, 0, 0);
+		return;
+	}
+
+	nconnects++;
+	c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(c->fd == INVALID_SOCKET) {
+		replay_complete(c, 0, 0);
+		return;
+	}
+	ev.events = EPOLLOUT;
+	ev.data.ptr = c;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev)) {
+		close(c->fd);
+		c->fd = INVALID_SOCKET;
+		replay_complete(c, 0, 0);
+		return;
+	}
+	c->state = REPLAY_CONNECTING;
+	if(connect(c->fd, (struct sockaddr *)&target, sizeof(target)) == 0) {
+		if(!replay_send(c))
+			replay_complete(c, 0, 0);
+	}
+	else if(errno != EINPROGRESS) {
+		replay_complete(c, 0, 0);
+	}
+}
+/* Parse a complete response head.
+ */
+static int replay_parse_head(replay_client_t *c, const char *end)
+{
+	const char *line, *nl;
+	int minor, status;
+
+	if(sscanf(c->head, "HTTP/1.%d %d", &minor, &status) != 2)
+		return 0;
+	if(minor == 0)
+		c->close = true;
+
+	for(line = strstr(c->head, "\r\n") + 2; line < end; line = nl + 2) {
+		nl = strstr(line, "\r\n");
+		if(nl == NULL || nl == line)
+			break;
+		if(strncasecmp(line, "Content-Length:", 15) == 0)
+			c->remaining = strtoll(line + 15, NULL, 10);
+		else if(strncasecmp(line, "Connection:", 11) == 0)
+			c->close = strncasecmp(line + 11, " keep-alive", 11) != 0;
+	}
+
+	/* No body for these whatever the headers say */
+	if(status == 204 || status == 304 ||
+			strncmp(reqs[c->next].line, "HEAD ", 5) == 0)
+		c->remaining = 0;
+	return status;
+}
+/* Read what the server sent, completing the request once the whole
+ * response arrived.
+ */
+static void replay_read(replay_client_t *c)
+{
+	static char buffer[65536];
+	const char *end;
+	long nbytes;
+	size_t n;
+
+	for(;;) {
+		nbytes = recv(c->fd, buffer, sizeof(buffer), 0);
+		if(nbytes < 0) {
+			if(errno == EINTR)
+				continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			replay_complete(c, 0, 0);
+			return;
+		}
+		if(nbytes == 0) {
+			/* A kept connection may close just as it is reused */
+			if(c->reused && c->hlen == 0) {
+				replay_disconnect(c);
+				replay_start(c);
+				return;
+			}
+			/* Close delimits a body without a length */
+			c->close = true;
+			replay_complete(c, c->header_done && c->remaining < 0 ?
+				c->status : 0, c->bytes);
+			return;
+		}
+
+		if(!c->header_done) {
+			n = (size_t)nbytes;
+			if(n > sizeof(c->head) - 1 - c->hlen)
+				n = sizeof(c->head) - 1 - c->hlen;
+			memcpy(c->head + c->hlen, buffer, n);
+			c->hlen += n;
+			c->head[c->hlen] = '\0';
+			end = strstr(c->head, "\r\n\r\n");
+			if(end == NULL) {
+				if(c->hlen == sizeof(c->head) - 1) {
+					replay_complete(c, 0, 0);
+					return;
+				}
+				continue;
+			}
+			c->status = replay_parse_head(c, end);
+			if(c->status == 0) {
+				replay_complete(c, 0, 0);
+				return;
+			}
+			c->header_done = true;
+			c->bytes = 0;
+			/* The rest of what was read belongs to the body */
+			nbytes = (long)(c->hlen - (end + 4 - c->head)) +
+				(nbytes - (long)n);
+		}
+
+		c->bytes += nbytes;
+		if(c->remaining >= 0) {
+			c->remaining -= nbytes;
+			if(c->remaining <= 0) {
+				replay_complete(c, c->status, c->bytes);
+				return;
+			}
+		}
+	}
+}
+/* Fail requests that are past their deadline, returns milliseconds until
+ * the next one is due or -1 when none is pending.
+ */
+static int replay_expire(uint64_t now)
+{
+	replay_timer_t *t;
+	replay_client_t *c;
+
+	while(timer_head < ntimers) {
+		t = &timers[timer_head];
+		c = &clients[t->client];
+
+		/* Answered, or restarted with a later deadline */
+		if(reqs[t->req].done || c->next != t->req ||
+				c->deadline != t->deadline) {
+			timer_head++;
+			continue;
+		}
+		if(t->deadline > now)
+			return (int)((t->deadline - now + 999) / 1000);
+		timer_head++;
+		ntimeouts++;
+		replay_complete(c, 0, 0);
+	}
+	return -1;
+}
+/* Handle an event on a client connection.
+ */
+static void replay_event(replay_client_t *c, uint32_t events)
+{
+	socklen_t len = sizeof(int);
+	int err = 0;
+
+	/* The server closed a kept connection between requests */
+	if(c->state == REPLAY_IDLE) {
+		replay_disconnect(c);
+	}
+	else if(c->state == REPLAY_CONNECTING) {
+		if(getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err ||
+				!replay_send(c))
+			replay_complete(c, 0, 0);
+	}
+	else if(c->state == REPLAY_SENDING) {
+		if(!replay_flush(c))
+			replay_complete(c, 0, 0);
+	}
+	else if(c->state == REPLAY_WAITING &&
+			(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+		replay_read(c);
+	}
+}
+/* Replay every request, speed 0 sends each as soon as its connection is
+ * free.
+ */
+static int replay_run(double speed, uint64_t *elapsed)
+{
+	struct epoll_event events[256];
+	replay_client_t *c;
+	size_t cursor = 0;
+	uint64_t start, now, wait;
+	int *order, timeout, expire, i, n;
+
+	/* A request is started at most twice, once more if its kept
+	 * connection was closed just as it was reused
+	 */
+	order = malloc((nreqs > 0 ? nreqs : 1) * sizeof(int));
+	runq = malloc((nclients > 0 ? nclients : 1) * sizeof(int));
+	timers = malloc((nreqs > 0 ? nreqs * 2 : 1) * sizeof(replay_timer_t));
+	if(order == NULL || runq == NULL || timers == NULL) {
+		free(order);
+		free(runq);
+		free(timers);
+		return -1;
+	}
+	for(i = 0; i < (int)nreqs; i++)
+		order[i] = i;
+	qsort(order, nreqs, sizeof(int), replay_cmp_due);
+
+	start = replay_now();
+	while(ndone < nreqs) {
+		now = replay_now() - start;
+
+		/* Start every request that is due on a free connection */
+		while(cursor < nreqs && (speed <= 0 ||
+				reqs[order[cursor]].due <= (uint64_t)(now * speed))) {
+			replay_request_t *r = &reqs[order[cursor++]];
+
+			r->ready = true;
+			c = &clients[r->client];
+			if(c->state == REPLAY_IDLE && &reqs[c->next] == r)
+				replay_start(c);
+			while(nrun > 0)
+				replay_start(&clients[runq[--nrun]]);
+		}
+
+		timeout = 1000;
+		if(cursor < nreqs && speed > 0) {
+			wait = (uint64_t)(reqs[order[cursor]].due / speed);
+			wait = wait > now ? (wait - now + 999) / 1000 : 0;
+			timeout = wait < 1000 ? (int)wait : 1000;
+		}
+		expire = replay_expire(replay_now());
+		if(expire >= 0 && expire < timeout)
+			timeout = expire;
+
+		n = epoll_wait(epfd, events, 256, timeout);
+		if(n < 0 && errno != EINTR)
+			break;
+		for(i = 0; i < n; i++) {
+			c = events[i].data.ptr;
+			replay_event(c, events[i].events);
+		}
+
+		/* Connections freed above go on with their next request */
+		replay_expire(replay_now());
+		while(nrun > 0)
+			replay_start(&clients[runq[--nrun]]);
+	}
+	*elapsed = replay_now() - start;
+	free(order);
+	free(runq);
+	free(timers);
+	return ndone < nreqs ? -1 : 0;
+}
+/* Order latencies.
+ */
+static int replay_cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+/* Order request indices by path, then latency.
+ */
+static int replay_cmp_path(const void *a, const void *b)
+{
+	const replay_request_t *x = &reqs[*(const int *)a];
+	const replay_request_t *y = &reqs[*(const int *)b];
+	int rc = strcmp(x->path, y->path);
+
+	if(rc != 0)
+		return rc;
+	return x->latency < y->latency ? -1 : x->latency > y->latency;
+}
+/* Order paths by request count, busiest first.
+ */
+static int replay_cmp_count(const void *a, const void *b)
+{
+	const replay_path_t *x = a, *y = b;
+
+	if(x->count != y->count)
+		return x->count > y->count ? -1 : 1;
+	return strcmp(x->path, y->path);
+}
+/* Get the pct percentile of n sorted values.
+ */
+static uint64_t replay_pct(const uint64_t *v, size_t n, double pct)
+{
+	size_t i;
+
+	if(n == 0)
+		return 0;
+	i = (size_t)(pct / 100.0 * n + 0.999999);
+	return v[i > 0 ? i - 1 : 0];
+}
+/* Print throughput, latency percentiles and the busiest paths.
+ */
+static void replay_report(uint64_t elapsed, size_t npaths)
+{
+	unsigned long long status[600] = { 0 }, bytes = 0;
+	replay_path_t *paths;
+	uint64_t *lat, sum;
+	size_t i, j, k, count = 0;
+	double secs = elapsed / 1e6;
+	int *order;
+
+	lat = malloc((nreqs > 0 ? nreqs : 1) * sizeof(uint64_t));
+	order = malloc((nreqs > 0 ? nreqs : 1) * sizeof(int));
+	paths = calloc(nreqs > 0 ? nreqs : 1, sizeof(replay_path_t));
+	if(lat == NULL || order == NULL || paths == NULL) {
+		free(lat);
+		free(order);
+		free(paths);
+		return;
+	}
+
+	for(i = 0; i < nreqs; i++) {
+		lat[i] = reqs[i].latency;
+		order[i] = (int)i;
+		bytes += reqs[i].bytes;
+		status[reqs[i].status < 600 ? reqs[i].status : 0]++;
+	}
+	qsort(lat, nreqs, sizeof(uint64_t), replay_cmp_u64);
+
+	printf("requests: %zu connections: %zu connects: %llu errors: %llu "
+		"timeouts: %llu elapsed: %.3fs\n", nreqs, nclients, nconnects,
+		nerrors, ntimeouts, secs);
+	printf("throughput: %.1f req/s %.2f MiB/s\n",
+		secs > 0 ? nreqs / secs : 0.0,
+		secs > 0 ? bytes / secs / 1048576.0 : 0.0);
+	printf("latency ms: min=%.3f p50=%.3f p90=%.3f p99=%.3f p99.9=%.3f "
+		"max=%.3f\n", nreqs ? lat[0] / 1e3 : 0.0,
+		replay_pct(lat, nreqs, 50) / 1e3, replay_pct(lat, nreqs, 90) / 1e3,
+		replay_pct(lat, nreqs, 99) / 1e3, replay_pct(lat, nreqs, 99.9) / 1e3,
+		nreqs ? lat[nreqs - 1] / 1e3 : 0.0);
+	printf("status:");
+	for(i = 0; i < 600; i++) {
+		if(status[i] > 0 && i == 0)
+			printf(" error=%llu", status[i]);
+		else if(status[i] > 0)
+			printf(" %zu=%llu", i, status[i]);
+	}
+	printf("\n\n");
+
+	/* Group by path, each group comes out sorted by latency */
+	qsort(order, nreqs, sizeof(int), replay_cmp_path);
+	for(i = 0; i < nreqs; i = j) {
+		replay_path_t *p = &paths[count++];
+
+		for(j = i; j < nreqs && strcmp(reqs[order[i]].path,
+			reqs[order[j]].path) == 0; j++);
+		p->path = reqs[order[i]].path;
+		p->count = j - i;
+		for(k = i, sum = 0; k < j; k++) {
+			lat[k - i] = reqs[order[k]].latency;
+			sum += lat[k - i];
+			p->bytes += reqs[order[k]].bytes;
+			if(reqs[order[k]].status == 0)
+				p->errors++;
+		}
+		p->mean = sum / p->count;
+		p->p50 = replay_pct(lat, p->count, 50);
+		p->p99 = replay_pct(lat, p->count, 99);
+		p->max = lat[p->count - 1];
+	}
+	qsort(paths, count, sizeof(replay_path_t), replay_cmp_count);
+
+	printf("%8s %6s %9s %9s %9s %9s %10s  %s\n", "COUNT", "ERRORS",
+		"MEAN_MS", "P50_MS", "P99_MS", "MAX_MS", "KB", "PATH");
+	for(i = 0; i < count && i < npaths; i++)
+		printf("%8zu %6zu %9.3f %9.3f %9.3f %9.3f %10.1f  %s\n",
+			paths[i].count, paths[i].errors, paths[i].mean / 1e3,
+			paths[i].p50 / 1e3, paths[i].p99 / 1e3, paths[i].max / 1e3,
+			paths[i].bytes / 1024.0, paths[i].path);
+	if(count > npaths)
+		printf("... %zu more paths\n", count - npaths);
+
+	free(lat);
+	free(order);
+	free(paths);
+}
+/* Print usage information.
+ */
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-s speed] [-a address] [-n paths] "
+		"[-t timeout] trace [port]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	struct addrinfo hints, *res;
+	const char *port = "8080";
+	double speed = 1.0, timeout;
+	long npaths = REPLAY_PATHS;
+	uint64_t elapsed = 0;
+	size_t i;
+	int c, rc;
+
+	target_name = "127.0.0.1";
+	while((c = getopt(argc, argv, "s:a:n:t:")) != -1) {
+		switch(c) {
+			case 's':
+				speed = strtod(optarg, NULL);
+				if(speed < 0) {
+					fprintf(stderr, "Error: Invalid speed.\n");
+					return 1;
+				}
+				break;
+			case 'a':
+				target_name = optarg;
+				break;
+			case 'n':
+				npaths = strtol(optarg, NULL, 10);
+				if(npaths < 0) {
+					fprintf(stderr, "Error: Invalid path count.\n");
+					return 1;
+				}
+				break;
+			case 't':
+				timeout = strtod(optarg, NULL);
+				if(timeout <= 0) {
+					fprintf(stderr, "Error: Invalid timeout.\n");
+					return 1;
+				}
+				request_timeout = (uint64_t)(timeout * 1e6);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if(optind >= argc || argc - optind > 2) {
+		usage(argv[0]);
+		return 1;
+	}
+	if(optind + 1 < argc)
+		port = argv[optind + 1];
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if(getaddrinfo(target_name, port, &hints, &res) || res == NULL) {
+		fprintf(stderr, "Error: Cannot resolve '%s'.\n", target_name);
+		return 1;
+	}
+	memcpy(&target, res->ai_addr, sizeof(target));
+	freeaddrinfo(res);
+
+	if(replay_load(argv[optind])) {
+		fprintf(stderr, "Error: Cannot read trace '%s'.\n", argv[optind]);
+		return 1;
+	}
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(epfd < 0) {
+		fprintf(stderr, "Error: Cannot create epoll set.\n");
+		return 1;
+	}
+
+	rc = replay_run(speed, &elapsed);
+	if(rc)
+		fprintf(stderr, "Error: Replay stopped after %zu of %zu requests.\n",
+			ndone, nreqs);
+	replay_report(elapsed, (size_t)npaths);
+
+	for(i = 0; i < nclients; i++)
+		replay_disconnect(&clients[i]);
+	for(i = 0; i < nreqs; i++) {
+		free(reqs[i].line);
+		free(reqs[i].host);
+		free(reqs[i].path);
+	}
+	free(clients);
+	free(reqs);
+	close(epfd);
+	return rc ? 1 : 0;
+}
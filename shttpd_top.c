@@ -0,0 +1,159 @@
+/*
+ * shttpd_top.c - Live view of a running server's scoreboard.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "scoreboard.h"
+
+/* Milliseconds between refreshes by default */
+#define TOP_DELAY 1000
+
+static const char *states[] = { "idle", "reading", "sending" };
+
+/* Get monotonic time in nanoseconds.
+ */
+static uint64_t top_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/* Print one screen, rates are per second since the previous screen.
+ */
+static void top_print(const scoreboard_t *sb, const char *name,
+	uint64_t *last_reqs, uint64_t *last_bytes, double secs)
+{
+	static const char *lanes[THREADPOOL_LANE_COUNT] = { "fast", "bulk" };
+	scoreboard_global_t g;
+	scoreboard_slot_t slot;
+	uint64_t now = top_now(), total = 0;
+	unsigned long up;
+	int i, nslots;
+
+	/* The writer owns the segment, never index past the rate arrays */
+	nslots = (int)sb->nslots;
+	if(nslots > SCOREBOARD_SLOTS)
+		nslots = SCOREBOARD_SLOTS;
+
+	scoreboard_read_global(sb, &g);
+	up = (unsigned long)((now - sb->started) / 1000000000ULL);
+	printf("\033[H\033[J%s  pid %d  up %lu:%02lu:%02lu  %s\n\n", name,
+		(int)sb->pid, up / 3600, up / 60 % 60, up % 60,
+		kill(sb->pid, 0) == 0 || errno == EPERM ? "running" : "gone");
+
+	for(i = 0; i < THREADPOOL_LANE_COUNT; i++)
+		printf("%s: queued=%llu active=%llu/%llu completed=%llu "
+			"wait_avg=%lluus p99=%lluus\n", lanes[i],
+			(unsigned long long)g.lanes[i].queued,
+			(unsigned long long)g.lanes[i].active,
+			(unsigned long long)g.lanes[i].limit,
+			(unsigned long long)g.lanes[i].completed,
+			(unsigned long long)g.lanes[i].wait_avg,
+			(unsigned long long)g.lanes[i].p99);
+	printf("cache: entries=%llu bytes=%llu hits=%llu misses=%llu "
+		"evictions=%llu\n\n", (unsigned long long)g.cache_entries,
+		(unsigned long long)g.cache_bytes,
+		(unsigned long long)g.cache_hits,
+		(unsigned long long)g.cache_misses,
+		(unsigned long long)g.cache_evictions);
+
+	printf("%3s %4s %-8s %8s %10s %12s %10s %8s  %s\n", "ID", "CPU",
+		"STATE", "TIME", "REQS", "BYTES", "REQ/S", "KB/S", "PATH");
+	for(i = 0; i < nslots; i++) {
+		scoreboard_read_slot(sb, i, &slot);
+		total += slot.requests;
+		printf("%3d %4d %-8s %7.1fs %10llu %12llu %10.1f %8.1f  %s\n", i,
+			(int)slot.cpu, slot.state < 3 ? states[slot.state] : "?",
+			slot.since ? (now - slot.since) / 1e9 : 0.0,
+			(unsigned long long)slot.requests,
+			(unsigned long long)slot.bytes,
+			secs > 0 ? (slot.requests - last_reqs[i]) / secs : 0.0,
+			secs > 0 ? (slot.bytes - last_bytes[i]) / secs / 1024 : 0.0,
+			slot.path);
+		last_reqs[i] = slot.requests;
+		last_bytes[i] = slot.bytes;
+	}
+	printf("\ntotal requests: %llu\n", (unsigned long long)total);
+	fflush(stdout);
+}
+/* Print usage information.
+ */
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-d delay_ms] [-n count] [port|shm_name]\n",
+		prog);
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t last_reqs[SCOREBOARD_SLOTS] = { 0 };
+	uint64_t last_bytes[SCOREBOARD_SLOTS] = { 0 };
+	const scoreboard_t *sb;
+	struct timespec ts;
+	long delay = TOP_DELAY, count = -1;
+	char name[256];
+	uint64_t last = 0, now;
+	int c;
+
+	while((c = getopt(argc, argv, "d:n:")) != -1) {
+		switch(c) {
+			case 'd':
+				delay = strtol(optarg, NULL, 10);
+				if(delay <= 0) {
+					fprintf(stderr, "Error: Invalid delay.\n");
+					return 1;
+				}
+				break;
+			case 'n':
+				count = strtol(optarg, NULL, 10);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if(argc - optind > 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* A bare port number names the server's default scoreboard */
+	if(optind < argc && argv[optind][0] == '/')
+		snprintf(name, sizeof(name), "%s", argv[optind]);
+	else
+		snprintf(name, sizeof(name), SCOREBOARD_NAME, (unsigned short)
+			strtoul(optind < argc ? argv[optind] : "8080", NULL, 10));
+
+	sb = scoreboard_open(name);
+	if(sb == NULL) {
+		fprintf(stderr, "Error: Cannot open scoreboard '%s'.\n", name);
+		return 1;
+	}
+
+	ts.tv_sec = delay / 1000;
+	ts.tv_nsec = delay % 1000 * 1000000L;
+	while(count < 0 || count-- > 0) {
+		now = top_now();
+		top_print(sb, name, last_reqs, last_bytes,
+			last ? (now - last) / 1e9 : 0.0);
+		last = now;
+		if(count != 0)
+			nanosleep(&ts, NULL);
+	}
+
+	scoreboard_close(sb);
+	return 0;
+}
@@ -8,41 +8,107 @@
  *
  * Changes:
  *     - Redesigned 06/30/2021 - Now uses a linked list.
+ *     - Added scheduling lanes so cheap tasks don't queue behind bulk ones.
+ *     - Added batch submission of tasks.
+ *     - Added CPU pinning and steering of tasks to per-worker queues.
  *
  ***************************************************************************
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+
+#include <string.h>
 
 #ifdef __linux
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
 #endif
 
 #include "threadpool.h"
+#include "trace.h"
+
+/* Number of fast tasks taken in a row before a waiting bulk task runs. */
+#ifndef THREADPOOL_FAST_WEIGHT
+#define THREADPOOL_FAST_WEIGHT 4
+#endif
+
+/* Size of each worker's scratch buffer. */
+#ifndef THREADPOOL_BUFFER_SIZE
+#define THREADPOOL_BUFFER_SIZE (64 * 1024)
+#endif
+
+/* Latency histogram buckets, bucket i counts [2^i, 2^(i+1)) microseconds. */
+#define THREADPOOL_HIST_BUCKETS 32
 
 /* Task structure for the thread pool. */
 typedef struct threadpool_task {
     thread_func_t func;
     void *arg;
+    unsigned long long queued_at;
     struct threadpool_task *next;
 } threadpool_task_t;
 
-/* Main structure for the thread pool. */
-struct threadpool {
+/* Lane structure, each lane has its own queue and statistics. */
+typedef struct threadpool_lane {
+    threadpool_task_t *task_first;
+    threadpool_task_t *task_last;
+    size_t queued;
+    size_t active;
+    size_t limit;
+    unsigned long long completed;
+    unsigned long long wait_total;
+    unsigned long long run_total;
+    unsigned long long max;
+    unsigned long long hist[THREADPOOL_HIST_BUCKETS];
+} threadpool_lane_t;
+
+/* Worker structure, tasks steered to the worker's CPU wait in its own
+ * queue and count towards the fast lane.
+ */
+typedef struct threadpool_worker {
+    struct threadpool *tp;
+    int cpu;
+    int node;
+    bool busy;
     threadpool_task_t *task_first;
     threadpool_task_t *task_last;
+    unsigned long long steered;
+    unsigned long long stolen;
+} threadpool_worker_t;
+
+/* Main structure for the thread pool. */
+struct threadpool {
+    threadpool_lane_t lanes[THREADPOOL_LANE_COUNT];
+    threadpool_worker_t *workers;
+    size_t worker_count;
+    bool pinned;
     pthread_mutex_t task_mutex;
     pthread_cond_t task_cond;
     pthread_cond_t tasking_cond;
+    size_t fast_streak;
     size_t tasking_count;
     size_t thread_count;
     bool stop;
 };
 
+/* Scratch buffer and index of the current worker. */
+static _Thread_local void *worker_buffer;
+static _Thread_local int worker_id = -1;
+
 /* ---------------------------- Private Functions ------------------------ */
 
+/* Get monotonic time in microseconds.
+ */
+static unsigned long long threadpool_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
 /* Create a task.
  */
 static threadpool_task_t *threadpool_task_create(thread_func_t func, void *arg)
@@ -54,6 +120,7 @@ static threadpool_task_t *threadpool_task_create(thread_func_t func, void *arg)
     if(task != NULL) {
         task->func = func;
         task->arg = arg;
+        task->queued_at = threadpool_now();
         task->next = NULL;
     }
     return task;
@@ -66,53 +133,230 @@ static void threadpool_task_destroy(threadpool_task_t *task)
         free(task);
     }
 }
-/* Get a task from the thread pool.
+/* Check if any lane has queued tasks.
+ */
+static bool threadpool_pending(threadpool_t *tp)
+{
+    int i;
+
+    for(i = 0; i < THREADPOOL_LANE_COUNT; i++)
+        if(tp->lanes[i].task_first != NULL)
+            return true;
+    for(i = 0; i < (int)tp->worker_count; i++)
+        if(tp->workers[i].task_first != NULL)
+            return true;
+    return false;
+}
+/* Pick the lane the next task should come from, -1 if none may run.
+ */
+static int threadpool_lane_pick(threadpool_t *tp)
+{
+    threadpool_lane_t *fast = &tp->lanes[THREADPOOL_LANE_FAST];
+    threadpool_lane_t *bulk = &tp->lanes[THREADPOOL_LANE_BULK];
+    bool fast_ok, bulk_ok;
+
+    fast_ok = fast->task_first != NULL && fast->active < fast->limit;
+    bulk_ok = bulk->task_first != NULL && bulk->active < bulk->limit;
+
+    /* Let bulk work through every so often so it can't starve. */
+    if(bulk_ok && (!fast_ok || tp->fast_streak >= THREADPOOL_FAST_WEIGHT)) {
+        tp->fast_streak = 0;
+        return THREADPOOL_LANE_BULK;
+    }
+    if(fast_ok) {
+        if(bulk_ok)
+            tp->fast_streak++;
+        return THREADPOOL_LANE_FAST;
+    }
+    return -1;
+}
+/* Get a task from a lane of the thread pool.
  */
-static threadpool_task_t *threadpool_task_get(threadpool_t *tp)
+static threadpool_task_t *threadpool_task_get(threadpool_t *tp, int lane)
 {
+    threadpool_lane_t *l;
     threadpool_task_t *task;
 
     if(tp == NULL) return NULL;
-    task = tp->task_first;
+    l = &tp->lanes[lane];
+    task = l->task_first;
     if(task == NULL) return NULL;
 
     if(task->next == NULL) {
-        tp->task_first = NULL;
-        tp->task_last = NULL;
+        l->task_first = NULL;
+        l->task_last = NULL;
     }
     else {
-        tp->task_first = task->next;
+        l->task_first = task->next;
     }
+    l->queued--;
+    return task;
+}
+/* Append a task to a worker's queue.
+ */
+static void threadpool_worker_push(threadpool_worker_t *w,
+    threadpool_task_t *task)
+{
+    if(w->task_first == NULL)
+        w->task_first = task;
+    else
+        w->task_last->next = task;
+    w->task_last = task;
+}
+/* Take the first task from a worker's queue.
+ */
+static threadpool_task_t *threadpool_worker_pop(threadpool_worker_t *w)
+{
+    threadpool_task_t *task = w->task_first;
+
+    w->task_first = task->next;
+    if(w->task_first == NULL)
+        w->task_last = NULL;
+    task->next = NULL;
     return task;
 }
+/* Find the worker pinned to cpu.
+ */
+static threadpool_worker_t *threadpool_worker_find(threadpool_t *tp, int cpu)
+{
+    size_t i;
+
+    if(!tp->pinned || cpu < 0)
+        return NULL;
+    for(i = 0; i < tp->worker_count; i++)
+        if(tp->workers[i].cpu == cpu)
+            return &tp->workers[i];
+    return NULL;
+}
+/* Get the next task for worker w, its own queue first, then the shared
+ * lanes, then steered tasks waiting on a busy worker.
+ */
+static threadpool_task_t *threadpool_next(threadpool_t *tp,
+    threadpool_worker_t *w, int *lane)
+{
+    threadpool_lane_t *fast = &tp->lanes[THREADPOOL_LANE_FAST];
+    threadpool_worker_t *v;
+    size_t i;
+
+    if(w->task_first != NULL && fast->active < fast->limit) {
+        *lane = THREADPOOL_LANE_FAST;
+        fast->queued--;
+        return threadpool_worker_pop(w);
+    }
+
+    *lane = threadpool_lane_pick(tp);
+    if(*lane >= 0)
+        return threadpool_task_get(tp, *lane);
+
+    if(fast->active < fast->limit) {
+        for(i = 0; i < tp->worker_count; i++) {
+            v = &tp->workers[i];
+            if(v != w && v->busy && v->task_first != NULL) {
+                *lane = THREADPOOL_LANE_FAST;
+                fast->queued--;
+                w->stolen++;
+                return threadpool_worker_pop(v);
+            }
+        }
+    }
+    return NULL;
+}
+/* Record a finished task in the lane statistics.
+ */
+static void threadpool_lane_account(threadpool_lane_t *l,
+    unsigned long long wait, unsigned long long run)
+{
+    unsigned long long total = wait + run;
+    int bucket = 0;
+
+    while(bucket < THREADPOOL_HIST_BUCKETS - 1 && (total >> (bucket + 1)) != 0)
+        bucket++;
+
+    l->completed++;
+    l->wait_total += wait;
+    l->run_total += run;
+    l->hist[bucket]++;
+    if(total > l->max)
+        l->max = total;
+}
+/* Get the upper bound of the given percentile from a lane histogram.
+ */
+static unsigned long long threadpool_lane_percentile(threadpool_lane_t *l,
+    unsigned int pct)
+{
+    unsigned long long want, seen = 0;
+    int i;
+
+    if(l->completed == 0) return 0;
+    want = (l->completed * pct + 99) / 100;
+    for(i = 0; i < THREADPOOL_HIST_BUCKETS; i++) {
+        seen += l->hist[i];
+        if(seen >= want)
+            return (1ULL << (i + 1)) < l->max ? (1ULL << (i + 1)) : l->max;
+    }
+    return l->max;
+}
 /* Processes all tasks in the thread pool.
  */
 static void *threadpool_worker(void *arg)
 {
-    threadpool_t *tp = (threadpool_t *)arg;
-    threadpool_task_t *task;
+    threadpool_worker_t *w = (threadpool_worker_t *)arg;
+    threadpool_t *tp = w->tp;
+    threadpool_task_t *task = NULL;
+    unsigned long long start, end;
+    unsigned int cpu, node;
+    int lane = -1;
+
+    worker_id = (int)(w - tp->workers);
+
+    /* Already running on our CPU, so first touch puts the buffer on the
+     * local node.
+     */
+    worker_buffer = malloc(THREADPOOL_BUFFER_SIZE);
+    if(worker_buffer != NULL)
+        memset(worker_buffer, 0, THREADPOOL_BUFFER_SIZE);
+    if(getcpu(&cpu, &node) == 0)
+        w->node = (int)node;
 
     for(;;) {
         pthread_mutex_lock(&tp->task_mutex);
 
-        while(tp->task_first == NULL && !tp->stop)
+        while(!tp->stop && (task = threadpool_next(tp, w, &lane)) == NULL)
             pthread_cond_wait(&tp->task_cond, &tp->task_mutex);
 
-        if(tp->stop)
+        if(tp->stop) {
+            threadpool_task_destroy(task);
             break;
+        }
 
-        task = threadpool_task_get(tp);
+        w->busy = true;
+        tp->lanes[lane].active++;
         tp->tasking_count++;
         pthread_mutex_unlock(&tp->task_mutex);
 
+        start = end = threadpool_now();
         if(task != NULL) {
+            trace_task_begin(task->queued_at * 1000ULL);
             task->func(task->arg);
-            threadpool_task_destroy(task);
+            trace_task_end();
+            end = threadpool_now();
         }
 
         pthread_mutex_lock(&tp->task_mutex);
+        if(task != NULL) {
+            threadpool_lane_account(&tp->lanes[lane],
+                start - task->queued_at, end - start);
+            threadpool_task_destroy(task);
+            task = NULL;
+        }
+        w->busy = false;
+        tp->lanes[lane].active--;
         tp->tasking_count--;
-        if(!tp->stop && tp->tasking_count == 0 && tp->task_first == NULL)
+
+        /* A lane at its limit may have work that can run now. */
+        if(tp->lanes[lane].task_first != NULL)
+            pthread_cond_signal(&tp->task_cond);
+        if(!tp->stop && tp->tasking_count == 0 && !threadpool_pending(tp))
             pthread_cond_signal(&tp->tasking_cond);
         pthread_mutex_unlock(&tp->task_mutex);
     }
@@ -120,6 +364,8 @@ static void *threadpool_worker(void *arg)
     tp->thread_count--;
     pthread_cond_signal(&tp->tasking_cond);
     pthread_mutex_unlock(&tp->task_mutex);
+    free(worker_buffer);
+    worker_buffer = NULL;
     return NULL;
 }
 
@@ -128,27 +374,73 @@ static void *threadpool_worker(void *arg)
 /* Create the thread pool.
  */
 threadpool_t *threadpool_create(size_t num)
+{
+    return threadpool_create_pinned(num, NULL);
+}
+/* Create the thread pool, pinning worker i to the i-th CPU of cpus and
+ * wrapping around when there are more workers than CPUs.
+ */
+threadpool_t *threadpool_create_pinned(size_t num, const cpu_set_t *cpus)
 {
     threadpool_t *tp;
+    pthread_attr_t attr;
     pthread_t thread;
-    size_t i;
+    cpu_set_t one;
+    int cpu = -1;
+    size_t i, j;
 
     if(num == 0)
         num = 4;
+    if(cpus != NULL && CPU_COUNT(cpus) == 0)
+        return NULL;
 
     tp = calloc(1, sizeof(threadpool_t));
-    if(tp != NULL) {
-        tp->thread_count = num;
-        pthread_mutex_init(&tp->task_mutex, NULL);
-        pthread_cond_init(&tp->task_cond, NULL);
-        pthread_cond_init(&tp->tasking_cond, NULL);
-        tp->task_first = NULL;
-        tp->task_last = NULL;
-
-        for(i = 0; i < num; i++) {
-            pthread_create(&thread, NULL, threadpool_worker, tp);
-            pthread_detach(thread);
+    if(tp == NULL)
+        return NULL;
+    tp->workers = calloc(num, sizeof(threadpool_worker_t));
+    if(tp->workers == NULL) {
+        free(tp);
+        return NULL;
+    }
+
+    tp->worker_count = num;
+    tp->thread_count = num;
+    tp->pinned = cpus != NULL;
+    pthread_mutex_init(&tp->task_mutex, NULL);
+    pthread_cond_init(&tp->task_cond, NULL);
+    pthread_cond_init(&tp->tasking_cond, NULL);
+    for(i = 0; i < THREADPOOL_LANE_COUNT; i++)
+        tp->lanes[i].limit = num;
+
+    for(i = 0; i < num; i++) {
+        tp->workers[i].tp = tp;
+        tp->workers[i].cpu = -1;
+        tp->workers[i].node = -1;
+        pthread_attr_init(&attr);
+        if(cpus != NULL) {
+            /* Next CPU in the set, starting over at the end */
+            for(j = 0; j < CPU_SETSIZE; j++) {
+                cpu = (cpu + 1) % CPU_SETSIZE;
+                if(CPU_ISSET(cpu, cpus))
+                    break;
+            }
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &one);
+            tp->workers[i].cpu = cpu;
+        }
+        if(pthread_create(&thread, &attr, threadpool_worker,
+                &tp->workers[i])) {
+            /* Likely a CPU we may not run on, stop the ones started */
+            pthread_attr_destroy(&attr);
+            pthread_mutex_lock(&tp->task_mutex);
+            tp->thread_count = i;
+            pthread_mutex_unlock(&tp->task_mutex);
+            threadpool_destroy(tp);
+            return NULL;
         }
+        pthread_detach(thread);
+        pthread_attr_destroy(&attr);
     }
     return tp;
 }
@@ -157,15 +449,25 @@ threadpool_t *threadpool_create(size_t num)
 void threadpool_destroy(threadpool_t *tp)
 {
     threadpool_task_t *task1, *task2;
+    int i;
 
     if(tp == NULL) return;
 
     pthread_mutex_lock(&tp->task_mutex);
-    task1 = tp->task_first;
-    while(task1 != NULL) {
-        task2 = task1->next;
-        threadpool_task_destroy(task1);
-        task1 = task2;
+    for(i = 0; i < THREADPOOL_LANE_COUNT; i++) {
+        task1 = tp->lanes[i].task_first;
+        while(task1 != NULL) {
+            task2 = task1->next;
+            threadpool_task_destroy(task1);
+            task1 = task2;
+        }
+        tp->lanes[i].task_first = NULL;
+        tp->lanes[i].task_last = NULL;
+        tp->lanes[i].queued = 0;
+    }
+    for(i = 0; i < (int)tp->worker_count; i++) {
+        while(tp->workers[i].task_first != NULL)
+            threadpool_task_destroy(threadpool_worker_pop(&tp->workers[i]));
     }
     tp->stop = true;
     pthread_cond_broadcast(&tp->task_cond);
@@ -174,29 +476,172 @@ void threadpool_destroy(threadpool_t *tp)
     pthread_mutex_destroy(&tp->task_mutex);
     pthread_cond_destroy(&tp->task_cond);
     pthread_cond_destroy(&tp->tasking_cond);
+    free(tp->workers);
     free(tp);
 }
+/* Limit how many workers a lane may occupy, the rest stay reserved for
+ * the other lane.
+ */
+bool threadpool_set_lane_limit(threadpool_t *tp, int lane, size_t max)
+{
+    if(tp == NULL || lane < 0 || lane >= THREADPOOL_LANE_COUNT)
+        return false;
+
+    if(max == 0 || max > tp->thread_count)
+        max = tp->thread_count;
+
+    pthread_mutex_lock(&tp->task_mutex);
+    tp->lanes[lane].limit = max;
+    pthread_cond_broadcast(&tp->task_cond);
+    pthread_mutex_unlock(&tp->task_mutex);
+    return true;
+}
+/* Get a statistics snapshot for a lane.
+ */
+bool threadpool_get_stats(threadpool_t *tp, int lane, threadpool_stats_t *st)
+{
+    threadpool_lane_t *l;
+
+    if(tp == NULL || st == NULL || lane < 0 || lane >= THREADPOOL_LANE_COUNT)
+        return false;
+
+    pthread_mutex_lock(&tp->task_mutex);
+    l = &tp->lanes[lane];
+    st->queued = l->queued;
+    st->active = l->active;
+    st->limit = l->limit;
+    st->completed = l->completed;
+    st->wait_avg = l->completed ? l->wait_total / l->completed : 0;
+    st->run_avg = l->completed ? l->run_total / l->completed : 0;
+    st->p50 = threadpool_lane_percentile(l, 50);
+    st->p99 = threadpool_lane_percentile(l, 99);
+    st->max = l->max;
+    pthread_mutex_unlock(&tp->task_mutex);
+    return true;
+}
+/* Get placement and steering counters for each worker.
+ */
+size_t threadpool_get_workers(threadpool_t *tp, threadpool_worker_stats_t *ws,
+    size_t max)
+{
+    size_t i;
+
+    if(tp == NULL || ws == NULL)
+        return 0;
+
+    pthread_mutex_lock(&tp->task_mutex);
+    for(i = 0; i < max && i < tp->worker_count; i++) {
+        ws[i].cpu = tp->workers[i].cpu;
+        ws[i].node = tp->workers[i].node;
+        ws[i].steered = tp->workers[i].steered;
+        ws[i].stolen = tp->workers[i].stolen;
+    }
+    pthread_mutex_unlock(&tp->task_mutex);
+    return i;
+}
+/* Get the calling worker's scratch buffer, NULL outside the pool.
+ */
+void *threadpool_buffer(size_t *size)
+{
+    if(size != NULL)
+        *size = worker_buffer != NULL ? THREADPOOL_BUFFER_SIZE : 0;
+    return worker_buffer;
+}
+/* Get the calling worker's index.
+ */
+int threadpool_worker_id(void)
+{
+    return worker_id;
+}
 /* Adding tasks to the thread pool.
  */
 bool threadpool_add_task(threadpool_t *tp, thread_func_t func, void *arg)
+{
+    return threadpool_add_task_lane(tp, THREADPOOL_LANE_FAST, func, arg);
+}
+/* Adding a batch of tasks to the thread pool under one lock.
+ */
+bool threadpool_add_tasks(threadpool_t *tp, const threadpool_job_t *tasks,
+    size_t n)
+{
+    threadpool_task_t *first = NULL, *last = NULL, *task, *next;
+    threadpool_worker_t *w;
+    threadpool_lane_t *l;
+    size_t i;
+
+    if(tp == NULL || tasks == NULL) return false;
+    if(n == 0) return true;
+
+    /* Build the chain before taking the lock */
+    for(i = 0; i < n; i++) {
+        task = threadpool_task_create(tasks[i].func, tasks[i].arg);
+        if(task == NULL) {
+            while(first != NULL) {
+                task = first->next;
+                threadpool_task_destroy(first);
+                first = task;
+            }
+            return false;
+        }
+        if(first == NULL)
+            first = task;
+        else
+            last->next = task;
+        last = task;
+    }
+
+    pthread_mutex_lock(&tp->task_mutex);
+    l = &tp->lanes[THREADPOOL_LANE_FAST];
+    for(i = 0, task = first; task != NULL; i++, task = next) {
+        next = task->next;
+        task->next = NULL;
+
+        /* Steered tasks go to the worker on their CPU */
+        w = threadpool_worker_find(tp, tasks[i].cpu);
+        if(w != NULL) {
+            threadpool_worker_push(w, task);
+            w->steered++;
+        }
+        else if(l->task_first == NULL) {
+            l->task_first = task;
+            l->task_last = task;
+        }
+        else {
+            l->task_last->next = task;
+            l->task_last = task;
+        }
+    }
+    l->queued += n;
+    pthread_cond_broadcast(&tp->task_cond);
+    pthread_mutex_unlock(&tp->task_mutex);
+    return true;
+}
+/* Adding tasks to a lane of the thread pool.
+ */
+bool threadpool_add_task_lane(threadpool_t *tp, int lane, thread_func_t func,
+    void *arg)
 {
     threadpool_task_t *task;
+    threadpool_lane_t *l;
 
-    if(tp == NULL) return false;
+    if(tp == NULL || lane < 0 || lane >= THREADPOOL_LANE_COUNT)
+        return false;
 
     task = threadpool_task_create(func, arg);
     if(task == NULL)
         return false;
 
     pthread_mutex_lock(&tp->task_mutex);
-    if(tp->task_first == NULL) {
-        tp->task_first = task;
-        tp->task_last = tp->task_first;
+    l = &tp->lanes[lane];
+    if(l->task_first == NULL) {
+        l->task_first = task;
+        l->task_last = l->task_first;
     }
     else {
-        tp->task_last->next = task;
-        tp->task_last = task;
+        l->task_last->next = task;
+        l->task_last = task;
     }
+    l->queued++;
     pthread_cond_broadcast(&tp->task_cond);
     pthread_mutex_unlock(&tp->task_mutex);
     return true;
@@ -8,6 +8,9 @@
  *
  * Changes:
  *    - Redesigned 06/30/2021 - Now uses a linked list.
+ *    - Added scheduling lanes so cheap tasks don't queue behind bulk ones.
+ *    - Added batch submission of tasks.
+ *    - Added CPU pinning and steering of tasks to per-worker queues.
  *
  ****************************************************************************
  */
@@ -17,6 +20,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <sched.h>
 
 struct threadpool;
 typedef struct threadpool threadpool_t;
@@ -24,13 +28,69 @@ typedef struct threadpool threadpool_t;
 /* Thread pool task function typedef. */
 typedef void (*thread_func_t)(void *arg);
 
+/* Task description used for batch submission, cpu steers the task to the
+ * worker pinned to that CPU or is -1 for any worker. */
+typedef struct threadpool_job {
+    thread_func_t func;
+    void *arg;
+    int cpu;
+} threadpool_job_t;
+
+/* Scheduling lanes, fast lane is preferred when both have work. */
+enum {
+    THREADPOOL_LANE_FAST,
+    THREADPOOL_LANE_BULK,
+    THREADPOOL_LANE_COUNT
+};
+
+/* Snapshot of per-lane statistics, times in microseconds. */
+typedef struct threadpool_stats {
+    size_t queued;
+    size_t active;
+    size_t limit;
+    unsigned long long completed;
+    unsigned long long wait_avg;
+    unsigned long long run_avg;
+    unsigned long long p50;
+    unsigned long long p99;
+    unsigned long long max;
+} threadpool_stats_t;
+
+/* Snapshot of a worker's placement and steering counters. */
+typedef struct threadpool_worker_stats {
+    int cpu;
+    int node;
+    unsigned long long steered;
+    unsigned long long stolen;
+} threadpool_worker_stats_t;
+
 /* Create a thread pool. */
 threadpool_t *threadpool_create(size_t num);
+/* Create a thread pool with each worker pinned to one CPU from cpus. */
+threadpool_t *threadpool_create_pinned(size_t num, const cpu_set_t *cpus);
 /* Destroy the thread pool. */
 void threadpool_destroy(threadpool_t *tp);
 
+/* Limit the number of workers a lane may occupy at once. */
+bool threadpool_set_lane_limit(threadpool_t *tp, int lane, size_t max);
+/* Get a statistics snapshot for a lane. */
+bool threadpool_get_stats(threadpool_t *tp, int lane, threadpool_stats_t *st);
+/* Get worker statistics, returns the number of workers filled in. */
+size_t threadpool_get_workers(threadpool_t *tp, threadpool_worker_stats_t *ws,
+    size_t max);
+/* Get the calling worker's scratch buffer, allocated on its NUMA node. */
+void *threadpool_buffer(size_t *size);
+/* Get the calling worker's index, -1 outside the pool. */
+int threadpool_worker_id(void);
+
 /* Add a task to the thread pool. */
 bool threadpool_add_task(threadpool_t *tp, thread_func_t func, void *arg);
+/* Add a batch of tasks to the thread pool with a single wakeup. */
+bool threadpool_add_tasks(threadpool_t *tp, const threadpool_job_t *tasks,
+    size_t n);
+/* Add a task to a specific lane of the thread pool. */
+bool threadpool_add_task_lane(threadpool_t *tp, int lane, thread_func_t func,
+    void *arg);
 /* Wait for all tasks to finish. */
 void threadpool_wait(threadpool_t *tp);
 
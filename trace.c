@@ -0,0 +1,279 @@
+/*
+ * trace.c - Source for sampled per-request phase tracing.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ *
+ * Each thread appends events to its own buffer, so recording takes no lock.
+ * Buffers are reset lazily by their owner when a new tracing session
+ * starts, and only read by the dump after tracing was turned off. The dump
+ * is written by its own thread, a new session waits until it is done.
+ *
+ ****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+/* Complete event, times in nanoseconds. */
+typedef struct trace_event {
+	const char *name;
+	unsigned long long start;
+	unsigned long long dur;
+	unsigned long req;
+} trace_event_t;
+
+/* Per-thread event buffer. */
+typedef struct trace_buffer {
+	_Atomic size_t count;
+	_Atomic unsigned long epoch;
+	int tid;
+	trace_event_t events[TRACE_EVENTS];
+} trace_buffer_t;
+
+static _Atomic bool trace_on;
+static _Atomic unsigned long trace_epoch;
+static _Atomic unsigned long trace_seq;
+static _Atomic unsigned long trace_reqs;
+static _Atomic unsigned int trace_sample = 1;
+static unsigned int trace_dumps;
+static char trace_dir[512] = TRACE_DIR;
+
+/* Thread writing the last session's dump */
+static pthread_t trace_writer;
+static bool trace_writing;
+static _Atomic bool trace_written;
+static char trace_path[sizeof(trace_dir) + 64];
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_buffer_t *trace_buffers[TRACE_MAX_THREADS];
+static int trace_nbuffers;
+
+/* Current thread's buffer and sampled task */
+static _Thread_local trace_buffer_t *trace_buf;
+static _Thread_local unsigned long trace_req;
+static _Thread_local unsigned long long trace_task_start;
+
+/* ---------------------------- Private Functions ------------------------ */
+
+/* Get the buffer for the current thread, creating it on first use.
+ */
+static trace_buffer_t *trace_buffer_get(void)
+{
+	trace_buffer_t *b;
+
+	if(trace_buf != NULL)
+		return trace_buf;
+
+	pthread_mutex_lock(&trace_lock);
+	if(trace_nbuffers < TRACE_MAX_THREADS) {
+		b = calloc(1, sizeof(trace_buffer_t));
+		if(b != NULL) {
+			b->tid = trace_nbuffers;
+			atomic_store(&b->epoch, atomic_load(&trace_epoch));
+			trace_buffers[trace_nbuffers++] = b;
+			trace_buf = b;
+		}
+	}
+	pthread_mutex_unlock(&trace_lock);
+	return trace_buf;
+}
+/* Append an event to the current thread's buffer.
+ */
+static void trace_record(const char *name, unsigned long long start,
+	unsigned long long end)
+{
+	trace_buffer_t *b = trace_buf;
+	unsigned long epoch;
+	size_t n;
+
+	/* Events from the last session were dumped already */
+	epoch = atomic_load_explicit(&trace_epoch, memory_order_relaxed);
+	if(atomic_load_explicit(&b->epoch, memory_order_relaxed) != epoch) {
+		atomic_store_explicit(&b->count, 0, memory_order_relaxed);
+		atomic_store_explicit(&b->epoch, epoch, memory_order_release);
+	}
+
+	n = atomic_load_explicit(&b->count, memory_order_relaxed);
+	if(n >= TRACE_EVENTS)
+		return;
+	b->events[n].name = name;
+	b->events[n].start = start;
+	b->events[n].dur = end > start ? end - start : 0;
+	b->events[n].req = trace_req;
+	atomic_store_explicit(&b->count, n + 1, memory_order_release);
+}
+/* Write the dump for the session that just ended.
+ */
+static void *trace_writer_main(void *arg)
+{
+	(void)arg;
+	if(trace_dump(trace_path) == 0)
+		fprintf(stderr, "Trace written to '%s'.\n", trace_path);
+	else
+		fprintf(stderr, "Error: Cannot write trace '%s'.\n", trace_path);
+	atomic_store(&trace_written, true);
+	return NULL;
+}
+
+/* ----------------------------- Public Functions ------------------------ */
+
+/* Get monotonic time in nanoseconds.
+ */
+unsigned long long trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/* Set the directory trace files are written to.
+ */
+int trace_set_dir(const char *dir)
+{
+	if(dir == NULL || dir[0] == '\0' || strlen(dir) >= sizeof(trace_dir))
+		return -1;
+	strcpy(trace_dir, dir);
+	return 0;
+}
+/* Trace one in every n tasks while tracing is on.
+ */
+void trace_set_sample(unsigned int n)
+{
+	atomic_store(&trace_sample, n ? n : 1);
+}
+/* Decide if the task about to run is sampled and record its queue time.
+ */
+void trace_task_begin(unsigned long long queued)
+{
+	trace_req = 0;
+	if(!atomic_load_explicit(&trace_on, memory_order_relaxed))
+		return;
+	if(atomic_fetch_add_explicit(&trace_seq, 1, memory_order_relaxed) %
+			atomic_load_explicit(&trace_sample, memory_order_relaxed) != 0)
+		return;
+	if(trace_buffer_get() == NULL)
+		return;
+
+	trace_req = atomic_fetch_add(&trace_reqs, 1) + 1;
+	trace_task_start = trace_now();
+	trace_record("queue", queued, trace_task_start);
+}
+/* Record the end of the current task.
+ */
+void trace_task_end(void)
+{
+	if(trace_req == 0)
+		return;
+	trace_record("task", trace_task_start, trace_now());
+	trace_req = 0;
+}
+/* Start a phase, returns 0 when the current task isn't sampled.
+ */
+unsigned long long trace_begin(void)
+{
+	return trace_req != 0 ? trace_now() : 0;
+}
+/* End a phase started with trace_begin().
+ */
+void trace_end(const char *name, unsigned long long start)
+{
+	if(start != 0 && trace_req != 0)
+		trace_record(name, start, trace_now());
+}
+/* Turn tracing on or off, turning it off dumps the trace to a file.
+ */
+bool trace_toggle(void)
+{
+	if(!atomic_load(&trace_on)) {
+		/* Buffers are still being read by the last dump */
+		if(trace_writing && !atomic_load(&trace_written)) {
+			fprintf(stderr, "Error: Trace still being written.\n");
+			return false;
+		}
+		trace_wait();
+		atomic_fetch_add(&trace_epoch, 1);
+		atomic_store(&trace_on, true);
+		fprintf(stderr, "Tracing started.\n");
+		return true;
+	}
+
+	atomic_store(&trace_on, false);
+	snprintf(trace_path, sizeof(trace_path), "%s/shttpd-trace-%d-%u.json",
+		trace_dir, (int)getpid(), ++trace_dumps);
+
+	/* A large dump would hold up accepting connections */
+	atomic_store(&trace_written, false);
+	trace_writing = pthread_create(&trace_writer, NULL, trace_writer_main,
+		NULL) == 0;
+	if(!trace_writing)
+		trace_writer_main(NULL);
+	return false;
+}
+/* Wait for the last dump to be written.
+ */
+void trace_wait(void)
+{
+	if(trace_writing) {
+		pthread_join(trace_writer, NULL);
+		trace_writing = false;
+	}
+}
+/* Write recorded events as a Chrome trace-event JSON file.
+ */
+int trace_dump(const char *path)
+{
+	unsigned long epoch = atomic_load(&trace_epoch);
+	const char *sep = "";
+	trace_buffer_t *b;
+	trace_event_t *e;
+	size_t i, n;
+	FILE *fp;
+	int fd, t, pid = (int)getpid();
+
+	/* Never follow or reuse a file someone else put there */
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+		0600);
+	if(fd < 0)
+		return -1;
+	fp = fdopen(fd, "w");
+	if(fp == NULL) {
+		close(fd);
+		return -1;
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	pthread_mutex_lock(&trace_lock);
+	for(t = 0; t < trace_nbuffers; t++) {
+		b = trace_buffers[t];
+		if(atomic_load_explicit(&b->epoch, memory_order_acquire) != epoch)
+			continue;
+
+		fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+			"\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}", sep, pid, b->tid,
+			b->tid);
+		sep = ",";
+
+		n = atomic_load_explicit(&b->count, memory_order_acquire);
+		for(i = 0; i < n; i++) {
+			e = &b->events[i];
+			fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"shttpd\",\"ph\":\"X\","
+				"\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+				"\"args\":{\"req\":%lu}}", e->name, e->start / 1000.0,
+				e->dur / 1000.0, pid, b->tid, e->req);
+		}
+	}
+	pthread_mutex_unlock(&trace_lock);
+	fprintf(fp, "\n]}\n");
+	return fclose(fp) ? -1 : 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * trace.h - Header for sampled per-request phase tracing.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+
+/* Events kept per thread between dumps */
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS 16384
+#endif
+
+/* Most threads that can record events */
+#define TRACE_MAX_THREADS 64
+
+/* Default directory trace files are written to */
+#ifndef TRACE_DIR
+#define TRACE_DIR "/tmp"
+#endif
+
+/* Get monotonic time in nanoseconds. */
+unsigned long long trace_now(void);
+
+/* Set the directory trace files are written to. */
+int trace_set_dir(const char *dir);
+
+/* Trace one in every n tasks while tracing is on. */
+void trace_set_sample(unsigned int n);
+
+/* Decide if the task about to run is sampled and record its queue time. */
+void trace_task_begin(unsigned long long queued);
+/* Record the end of the current task. */
+void trace_task_end(void);
+
+/* Start a phase, returns 0 when the current task isn't sampled. */
+unsigned long long trace_begin(void);
+/* End a phase started with trace_begin(). */
+void trace_end(const char *name, unsigned long long start);
+
+/* Turn tracing on or off, turning it off dumps the trace to a file. */
+bool trace_toggle(void);
+/* Wait for the last dump to be written. */
+void trace_wait(void);
+
+/* Write recorded events as a Chrome trace-event JSON file. */
+int trace_dump(const char *path);
+
+#endif
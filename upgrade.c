@@ -0,0 +1,277 @@
+/*
+ * upgrade.c - Source for handing the server over to a new binary.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ *
+ * The old process forks and execs the binary again with one end of a
+ * socket pair left open and named in the environment. The listening socket
+ * goes over it as SCM_RIGHTS together with a small header and the list of
+ * hot cached paths. The socket is never closed in between, so connections
+ * queue in the backlog instead of being refused while the new process
+ * starts, and the old process only stops accepting once it heard back.
+ * The answer is polled from the accept loop, which keeps serving parked
+ * connections in the meantime.
+ *
+ ****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "upgrade.h"
+
+extern char **environ;
+
+/* Message sent along with the listening socket. */
+struct upgrade_header {
+	uint32_t magic;
+	uint32_t next_conn;
+	uint64_t capture_started;
+	uint64_t hot_length;
+};
+
+/* Handoff socket in a process started by an upgrade */
+static SOCKET handoff = INVALID_SOCKET;
+
+/* ---------------------------- Private Functions ------------------------ */
+
+/* Build the new process' environment with the handoff socket named, it
+ * must be ready before fork as the child may only exec.
+ */
+static char **upgrade_environ(SOCKET fd)
+{
+	size_t i, j, n, length = strlen(UPGRADE_ENV);
+	char **envp;
+
+	for(n = 0; environ[n] != NULL; n++);
+	envp = calloc(n + 2, sizeof(char *));
+	if(envp == NULL)
+		return NULL;
+	for(i = j = 0; i < n; i++)
+		if(strncmp(environ[i], UPGRADE_ENV, length) != 0 ||
+				environ[i][length] != '=')
+			envp[j++] = environ[i];
+	envp[j] = malloc(length + 16);
+	if(envp[j] == NULL) {
+		free(envp);
+		return NULL;
+	}
+	snprintf(envp[j], length + 16, "%s=%d", UPGRADE_ENV, fd);
+	return envp;
+}
+/* Free an environment built by upgrade_environ().
+ */
+static void upgrade_environ_free(char **envp)
+{
+	size_t n;
+
+	for(n = 0; envp[n] != NULL; n++);
+	free(envp[n - 1]);
+	free(envp);
+}
+/* Send the header with the listening socket, then the hot path list.
+ */
+static int upgrade_send(SOCKET fd, const upgrade_state_t *st)
+{
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} ctl;
+	struct upgrade_header h;
+	struct cmsghdr *cm;
+	struct msghdr msg;
+	struct iovec iov;
+
+	memset(&h, 0, sizeof(h));
+	h.magic = UPGRADE_MAGIC;
+	h.next_conn = st->next_conn;
+	h.capture_started = st->capture_started;
+	h.hot_length = st->hot_length;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&ctl, 0, sizeof(ctl));
+	iov.iov_base = &h;
+	iov.iov_len = sizeof(h);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+	cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cm), &st->server, sizeof(int));
+
+	if(sendmsg(fd, &msg, MSG_NOSIGNAL) != (ssize_t)sizeof(h))
+		return -1;
+	if(st->hot_length > 0 && socket_send_all(fd, st->hot, st->hot_length) !=
+			(long)st->hot_length)
+		return -1;
+	return 0;
+}
+
+/* ----------------------------- Public Functions ------------------------ */
+
+/* Run exe with argv and hand it the state.
+ */
+int upgrade_spawn(upgrade_t *up, const char *exe, char *const argv[],
+	const upgrade_state_t *st)
+{
+	SOCKET sv[2];
+	char **envp;
+	pid_t pid;
+
+	up->pid = -1;
+	up->fd = INVALID_SOCKET;
+	if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv))
+		return -1;
+	envp = upgrade_environ(sv[1]);
+	if(envp == NULL) {
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+
+	pid = fork();
+	if(pid == 0) {
+		/* Only async-signal-safe calls until exec, other threads may
+		 * have held locks when we forked
+		 */
+		if(fcntl(sv[1], F_SETFD, 0) == 0)
+			execve(exe, argv, envp);
+		_exit(127);
+	}
+	upgrade_environ_free(envp);
+	close(sv[1]);
+	if(pid < 0) {
+		close(sv[0]);
+		return -1;
+	}
+
+	up->pid = pid;
+	up->fd = sv[0];
+	up->deadline = time(NULL) + UPGRADE_TIMEOUT;
+	if(upgrade_send(sv[0], st)) {
+		upgrade_abort(up);
+		return -1;
+	}
+	return 0;
+}
+/* Check if the new process is serving yet.
+ */
+int upgrade_check(upgrade_t *up)
+{
+	char ack = 0;
+	int rc;
+
+	if(up->fd == INVALID_SOCKET)
+		return -1;
+	rc = socket_wait(up->fd, POLLIN, 0);
+	if(rc == 0 && time(NULL) < up->deadline)
+		return 0;
+
+	/* Anything but the ready byte means it won't come up */
+	if(rc < 0 || recv(up->fd, &ack, 1, MSG_DONTWAIT) != 1 || ack != 'R') {
+		upgrade_abort(up);
+		return -1;
+	}
+	close(up->fd);
+	up->fd = INVALID_SOCKET;
+	return 1;
+}
+/* Give up on the new process.
+ */
+void upgrade_abort(upgrade_t *up)
+{
+	if(up->fd != INVALID_SOCKET)
+		close(up->fd);
+	up->fd = INVALID_SOCKET;
+	if(up->pid > 0) {
+		kill(up->pid, SIGKILL);
+		waitpid(up->pid, NULL, 0);
+	}
+	up->pid = -1;
+}
+/* Take over the state handed over by the old process.
+ */
+int upgrade_receive(upgrade_state_t *st)
+{
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} ctl;
+	struct sockaddr_storage addr;
+	struct upgrade_header h;
+	struct cmsghdr *cm;
+	struct msghdr msg;
+	struct iovec iov;
+	const char *env;
+	socklen_t len;
+
+	memset(st, 0, sizeof(upgrade_state_t));
+	st->server = INVALID_SOCKET;
+	env = getenv(UPGRADE_ENV);
+	if(env == NULL)
+		return 0;
+	handoff = (SOCKET)strtol(env, NULL, 10);
+	unsetenv(UPGRADE_ENV);
+	fcntl(handoff, F_SETFD, FD_CLOEXEC);
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &h;
+	iov.iov_len = sizeof(h);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+	if(recvmsg(handoff, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) !=
+			(ssize_t)sizeof(h) || h.magic != UPGRADE_MAGIC)
+		return -1;
+	cm = CMSG_FIRSTHDR(&msg);
+	if(cm == NULL || cm->cmsg_level != SOL_SOCKET ||
+			cm->cmsg_type != SCM_RIGHTS ||
+			cm->cmsg_len != CMSG_LEN(sizeof(int)))
+		return -1;
+	memcpy(&st->server, CMSG_DATA(cm), sizeof(int));
+
+	st->next_conn = h.next_conn;
+	st->capture_started = h.capture_started;
+	if(h.hot_length > 0) {
+		st->hot = malloc(h.hot_length + 1);
+		if(st->hot == NULL || recv(handoff, st->hot, h.hot_length,
+				MSG_WAITALL) != (ssize_t)h.hot_length) {
+			free(st->hot);
+			st->hot = NULL;
+			close(st->server);
+			return -1;
+		}
+		st->hot[h.hot_length] = '\0';
+		st->hot_length = h.hot_length;
+	}
+
+	len = sizeof(addr);
+	if(getsockname(st->server, (struct sockaddr *)&addr, &len) == 0 &&
+			addr.ss_family == AF_INET)
+		st->port = ntohs(((struct sockaddr_in *)&addr)->sin_port);
+	return 1;
+}
+/* Tell the old process this one is serving.
+ */
+void upgrade_ready(void)
+{
+	char ack = 'R';
+
+	if(handoff == INVALID_SOCKET)
+		return;
+	if(send(handoff, &ack, 1, MSG_NOSIGNAL) != 1)
+		fprintf(stderr, "Error: Cannot signal upgrade ready.\n");
+	close(handoff);
+	handoff = INVALID_SOCKET;
+}
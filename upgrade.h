@@ -0,0 +1,69 @@
+/*
+ * upgrade.h - Header for handing the server over to a new binary.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ */
+
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "network.h"
+
+/* Environment variable naming the handoff socket in the new process */
+#define UPGRADE_ENV "SHTTPD_UPGRADE_FD"
+
+/* Identifies a handoff message and its layout */
+#define UPGRADE_MAGIC 0x73687570U
+
+/* Seconds the old process waits for the new one to be ready */
+#define UPGRADE_TIMEOUT 10
+
+/* Seconds in-flight connections get to finish after a handoff */
+#define UPGRADE_DRAIN_SECS 30
+
+/* State handed from the old process to the new one. */
+typedef struct upgrade_state {
+	SOCKET server;
+	unsigned short port;
+	uint32_t next_conn;
+	uint64_t capture_started;
+	char *hot;
+	size_t hot_length;
+} upgrade_state_t;
+
+/* New process being started, up to when it is serving. */
+typedef struct upgrade {
+	pid_t pid;
+	SOCKET fd;
+	time_t deadline;
+} upgrade_t;
+
+/* Run exe with argv and hand it the state over a Unix socket, the
+ * listening socket going along as SCM_RIGHTS. Returns 0 when it was
+ * started, upgrade_check() then tells when it is ready. */
+int upgrade_spawn(upgrade_t *up, const char *exe, char *const argv[],
+	const upgrade_state_t *st);
+/* Check if the new process is serving without waiting. Returns 1 once it
+ * is, 0 while it is still starting and -1 when it failed or didn't answer
+ * within UPGRADE_TIMEOUT seconds, it has been killed then. */
+int upgrade_check(upgrade_t *up);
+/* Give up on the new process and kill it. */
+void upgrade_abort(upgrade_t *up);
+
+/* Take over the state handed over by the old process. Returns 1 when this
+ * process was started by an upgrade, 0 when it wasn't and -1 on error.
+ * The hot path list is malloc'd for the caller to free. */
+int upgrade_receive(upgrade_state_t *st);
+
+/* Tell the old process this one is serving, so it can stop accepting. */
+void upgrade_ready(void);
+
+#endif
@@ -0,0 +1,281 @@
+/*
+ * vhost.c - Source for name based virtual hosts.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ *
+ * Hosts are put in a hash table while the options are parsed and never
+ * change afterwards, so lookups from the workers take no lock. Each host
+ * has its own cache so one busy site can't evict another's entries.
+ *
+ ****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "abuffer.h"
+#include "cache.h"
+#include "vhost.h"
+
+static vhost_t *buckets[VHOST_BUCKETS];
+static vhost_t default_host;
+
+/* ---------------------------- Private Functions ------------------------ */
+
+/* Get the length of the host name part of a Host value, without port or
+ * trailing dot.
+ */
+static size_t vhost_name_length(const char *host, size_t length)
+{
+	size_t i;
+
+	if(length > 0 && host[0] == '[') {
+		for(i = 0; i < length && host[i] != ']'; i++);
+		return i < length ? i + 1 : length;
+	}
+	for(i = 0; i < length && host[i] != ':'; i++);
+	while(i > 0 && host[i-1] == '.')
+		i--;
+	return i;
+}
+/* Hash a host name, ignoring case.
+ */
+static unsigned long vhost_hash(const char *name, size_t length)
+{
+	unsigned long h = 2166136261UL;
+	size_t i;
+
+	for(i = 0; i < length; i++) {
+		h ^= (unsigned char)tolower((unsigned char)name[i]);
+		h *= 16777619UL;
+	}
+	return h;
+}
+/* Append cache statistics for one host.
+ */
+static void vhost_stats_one(vhost_t *vh, AppendBuffer *ab)
+{
+	cache_stats_t cs;
+	char line[512];
+
+	if(vh->cache == NULL)
+		return;
+
+	cache_get_stats(vh->cache, &cs);
+	snprintf(line, sizeof(line),
+		"cache %s: entries=%zu bytes=%zu budget=%zu hits=%llu misses=%llu "
+		"evictions=%llu ratio=%.3f\n", vh->name, cs.entries, cs.bytes,
+		cs.budget, cs.hits, cs.misses, cs.evictions,
+		cs.original ? (double)cs.stored / cs.original : 0.0);
+	ab_append(ab, line, strlen(line));
+}
+/* Append one host's most used cache entries.
+ */
+static void vhost_hottest_one(vhost_t *vh, const char *name, AppendBuffer *ab,
+	size_t max)
+{
+	cache_hot_t *hot;
+	char line[1600];
+	size_t i, n;
+
+	if(vh->cache == NULL)
+		return;
+	hot = calloc(max, sizeof(cache_hot_t));
+	if(hot == NULL)
+		return;
+
+	n = cache_hottest(vh->cache, hot, max);
+	for(i = 0; i < n; i++) {
+		if(strchr(hot[i].key, '\n') == NULL &&
+				strlen(hot[i].key) < sizeof(line) - sizeof(vh->name) - 16) {
+			snprintf(line, sizeof(line), "%d\t%s\t%s\n", hot[i].encoding, name,
+				hot[i].key);
+			ab_append(ab, line, strlen(line));
+		}
+		free(hot[i].key);
+	}
+	free(hot);
+}
+/* Add one host's cache statistics to a total.
+ */
+static void vhost_add_stats(vhost_t *vh, cache_stats_t *st)
+{
+	cache_stats_t cs;
+
+	if(vh->cache == NULL)
+		return;
+
+	cache_get_stats(vh->cache, &cs);
+	st->entries += cs.entries;
+	st->bytes += cs.bytes;
+	st->budget += cs.budget;
+	st->hits += cs.hits;
+	st->misses += cs.misses;
+	st->evictions += cs.evictions;
+	st->original += cs.original;
+	st->stored += cs.stored;
+}
+
+/* ----------------------------- Public Functions ------------------------ */
+
+/* Set up the default host.
+ */
+int vhost_set_default(const char *docroot, const char *index, size_t budget)
+{
+	if(strlen(docroot) >= sizeof(default_host.docroot) ||
+			strlen(index) >= sizeof(default_host.index))
+		return -1;
+
+	strcpy(default_host.name, "default");
+	strcpy(default_host.docroot, docroot);
+	strcpy(default_host.index, index);
+	default_host.cache = budget > 0 ? cache_create(budget) : NULL;
+	return budget > 0 && default_host.cache == NULL ? -1 : 0;
+}
+/* Add a host of the form "name=docroot[,index[,cache_bytes]]".
+ */
+int vhost_add(const char *spec, size_t budget)
+{
+	char buf[1024], *name, *docroot, *index, *bytes;
+	size_t i, length;
+	vhost_t *vh;
+
+	if(spec == NULL || strlen(spec) >= sizeof(buf))
+		return -1;
+	strcpy(buf, spec);
+
+	name = buf;
+	docroot = strchr(buf, '=');
+	if(docroot == NULL)
+		return -1;
+	*docroot++ = '\0';
+	index = strchr(docroot, ',');
+	if(index != NULL) {
+		*index++ = '\0';
+		bytes = strchr(index, ',');
+		if(bytes != NULL) {
+			*bytes++ = '\0';
+			budget = strtoul(bytes, NULL, 10);
+		}
+	}
+	if(index == NULL || *index == '\0')
+		index = "index.html";
+
+	length = vhost_name_length(name, strlen(name));
+	if(length == 0 || length >= sizeof(vh->name) || *docroot == '\0' ||
+			strlen(docroot) >= sizeof(vh->docroot) ||
+			strlen(index) >= sizeof(vh->index))
+		return -1;
+
+	vh = calloc(1, sizeof(vhost_t));
+	if(vh == NULL)
+		return -1;
+	for(i = 0; i < length; i++)
+		vh->name[i] = tolower((unsigned char)name[i]);
+	vh->hash = vhost_hash(vh->name, length);
+	strcpy(vh->docroot, docroot);
+	strcpy(vh->index, index);
+
+	/* Drop trailing slash, paths always start with one */
+	length = strlen(vh->docroot);
+	if(length > 1 && vh->docroot[length-1] == '/')
+		vh->docroot[length-1] = '\0';
+
+	if(budget > 0) {
+		vh->cache = cache_create(budget);
+		if(vh->cache == NULL) {
+			free(vh);
+			return -1;
+		}
+	}
+
+	vh->next = buckets[vh->hash & (VHOST_BUCKETS - 1)];
+	buckets[vh->hash & (VHOST_BUCKETS - 1)] = vh;
+	return 0;
+}
+/* Find the host for a Host header value.
+ */
+vhost_t *vhost_find(const char *host, size_t length)
+{
+	unsigned long hash;
+	vhost_t *vh;
+
+	if(host == NULL)
+		return &default_host;
+
+	length = vhost_name_length(host, length);
+	hash = vhost_hash(host, length);
+	for(vh = buckets[hash & (VHOST_BUCKETS - 1)]; vh != NULL; vh = vh->next) {
+		if(vh->hash == hash && strncasecmp(vh->name, host, length) == 0 &&
+				vh->name[length] == '\0')
+			return vh;
+	}
+	return &default_host;
+}
+/* Get the default host.
+ */
+vhost_t *vhost_default(void)
+{
+	return &default_host;
+}
+/* Append per-host cache statistics to an append buffer.
+ */
+void vhost_stats(AppendBuffer *ab)
+{
+	vhost_t *vh;
+	int i;
+
+	vhost_stats_one(&default_host, ab);
+	for(i = 0; i < VHOST_BUCKETS; i++)
+		for(vh = buckets[i]; vh != NULL; vh = vh->next)
+			vhost_stats_one(vh, ab);
+}
+/* Append the most used cache entries of every host.
+ */
+void vhost_hottest(AppendBuffer *ab, size_t max)
+{
+	vhost_t *vh;
+	int i;
+
+	vhost_hottest_one(&default_host, "", ab, max);
+	for(i = 0; i < VHOST_BUCKETS; i++)
+		for(vh = buckets[i]; vh != NULL; vh = vh->next)
+			vhost_hottest_one(vh, vh->name, ab, max);
+}
+/* Get cache statistics summed over all hosts.
+ */
+void vhost_get_stats(cache_stats_t *st)
+{
+	vhost_t *vh;
+	int i;
+
+	memset(st, 0, sizeof(cache_stats_t));
+	vhost_add_stats(&default_host, st);
+	for(i = 0; i < VHOST_BUCKETS; i++)
+		for(vh = buckets[i]; vh != NULL; vh = vh->next)
+			vhost_add_stats(vh, st);
+}
+/* Free all hosts and their caches.
+ */
+void vhost_cleanup(void)
+{
+	vhost_t *vh, *next;
+	int i;
+
+	for(i = 0; i < VHOST_BUCKETS; i++) {
+		for(vh = buckets[i]; vh != NULL; vh = next) {
+			next = vh->next;
+			cache_destroy(vh->cache);
+			free(vh);
+		}
+		buckets[i] = NULL;
+	}
+	cache_destroy(default_host.cache);
+	default_host.cache = NULL;
+}
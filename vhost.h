@@ -0,0 +1,57 @@
+/*
+ * vhost.h - Header for name based virtual hosts.
+ *
+ * Author: Philip R. Simonson
+ * Date  : 10/18/2026
+ *
+ ****************************************************************************
+ */
+
+#ifndef VHOST_H
+#define VHOST_H
+
+#include <stddef.h>
+
+#include "abuffer.h"
+#include "cache.h"
+
+/* Hash buckets for host lookup, must be a power of two */
+#define VHOST_BUCKETS 256
+
+/* Virtual host settings, read only once the server is running. */
+typedef struct vhost {
+	char name[256];
+	unsigned long hash;
+	char docroot[512];
+	char index[64];
+	cache_t *cache;
+	struct vhost *next;
+} vhost_t;
+
+/* Set up the default host used when no Host header matches. */
+int vhost_set_default(const char *docroot, const char *index, size_t budget);
+
+/* Add a host of the form "name=docroot[,index[,cache_bytes]]". */
+int vhost_add(const char *spec, size_t budget);
+
+/* Find the host for a Host header value, falls back to the default. */
+vhost_t *vhost_find(const char *host, size_t length);
+
+/* Get the default host. */
+vhost_t *vhost_default(void);
+
+/* Append per-host cache statistics to an append buffer. */
+void vhost_stats(AppendBuffer *ab);
+
+/* Append up to max of each host's most used cache entries, one
+ * "encoding<TAB>host<TAB>path" line each with an empty host for the
+ * default one. */
+void vhost_hottest(AppendBuffer *ab, size_t max);
+
+/* Get cache statistics summed over all hosts. */
+void vhost_get_stats(cache_stats_t *st);
+
+/* Free all hosts and their caches. */
+void vhost_cleanup(void);
+
+#endif